@@ -0,0 +1,203 @@
+#!/usr/bin/env python3
+
+"""Benchmark nickel's evaluation modes.
+
+Every workload (bench/*.nkl, plus programs generated on the fly) is run under
+every mode for a number of repetitions. For each workload and mode we report
+the minimum, median, 90th percentile and maximum wall time, the peak resident
+set size, and the median wall time spent in each phase (as reported by
+nickel's --stats=json), as JSON.
+
+Pass --baseline with the JSON of an earlier run to compare against it: any
+workload whose median wall time has grown by more than --threshold is
+reported as a regression, and the exit status is 1.
+"""
+
+import argparse
+import json
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+DEFAULT_NICKEL = os.path.join(BENCH_DIR, "..", "nickel")
+DEFAULT_MODES = ["interpreter", "vm", "jit", "orc", "tiered"]
+
+
+def function_name(i):
+    """Nickel identifiers are made of letters and underscores only."""
+    letters = ""
+
+    while True:
+        letters += chr(ord("a") + i % 26)
+        i //= 26
+        if i == 0:
+            return "f_" + letters
+
+
+def generate_many_definitions(count):
+    """A program of count definitions, each calling the one before it."""
+    lines = [f"def {function_name(0)}(x)", "  x + 1", "end", ""]
+
+    for i in range(1, count):
+        lines += [f"def {function_name(i)}(x)",
+                  f"  {function_name(i - 1)}(x + {i % 7}) - {i % 5}",
+                  "end", ""]
+
+    lines.append(f"puts {function_name(count - 1)}(1)")
+
+    return "\n".join(lines) + "\n"
+
+
+GENERATED_WORKLOADS = {
+    "many_definitions": lambda: generate_many_definitions(3000),
+}
+
+
+def percentile(values, fraction):
+    ordered = sorted(values)
+    position = (len(ordered) - 1) * fraction
+    lower = int(position)
+    upper = min(lower + 1, len(ordered) - 1)
+
+    return ordered[lower] + (ordered[upper] - ordered[lower]) * (position - lower)
+
+
+def run_once(nickel, mode, source_path):
+    """Run nickel once, returning (wall seconds, peak RSS in KB, phase times)."""
+    with open(source_path, "rb") as source, tempfile.TemporaryFile() as stderr:
+        start = time.perf_counter()
+        process = subprocess.Popen([nickel, "--" + mode, "--stats=json"],
+                                   stdin=source, stdout=subprocess.DEVNULL, stderr=stderr)
+        # wait4 gives the resource usage of this run alone.
+        _, status, rusage = os.wait4(process.pid, 0)
+        wall = time.perf_counter() - start
+        process.returncode = os.waitstatus_to_exitcode(status)
+
+        stderr.seek(0)
+        errors = stderr.read().decode(errors="replace").splitlines()
+
+    if process.returncode != 0:
+        raise RuntimeError(f"{mode} failed on {source_path}: {' '.join(errors[-1:])}")
+
+    phases = json.loads(errors[-1])["phases"]
+
+    return wall, rusage.ru_maxrss, {phase: times["wall"] for phase, times in phases.items()}
+
+
+def summarise(walls, rss, phases):
+    return {
+        "wall_seconds": {
+            "min": min(walls),
+            "median": statistics.median(walls),
+            "p90": percentile(walls, 0.9),
+            "max": max(walls),
+        },
+        "peak_rss_kb": max(rss),
+        "phase_seconds": {
+            phase: statistics.median(times[phase] for times in phases) for phase in phases[0]
+        },
+    }
+
+
+def workloads(selected, directory):
+    found = {}
+
+    for name in sorted(os.listdir(BENCH_DIR)):
+        if name.endswith(".nkl"):
+            found[name[:-len(".nkl")]] = os.path.join(BENCH_DIR, name)
+
+    for name, generate in GENERATED_WORKLOADS.items():
+        path = os.path.join(directory, name + ".nkl")
+        with open(path, "w", encoding="utf-8") as file:
+            file.write(generate())
+        found[name] = path
+
+    return {name: path for name, path in found.items() if not selected or name in selected}
+
+
+def run(args):
+    results = []
+
+    with tempfile.TemporaryDirectory() as directory:
+        for name, path in workloads(args.workloads, directory).items():
+            for mode in args.modes:
+                walls, rss, phases = [], [], []
+
+                for _ in range(args.repetitions):
+                    wall, peak_rss, phase_times = run_once(args.nickel, mode, path)
+                    walls.append(wall)
+                    rss.append(peak_rss)
+                    phases.append(phase_times)
+
+                result = {"workload": name, "mode": mode, **summarise(walls, rss, phases)}
+                results.append(result)
+
+                print(f"{name:20} {mode:12} median {result['wall_seconds']['median']:8.4f}s "
+                      f"p90 {result['wall_seconds']['p90']:8.4f}s rss {result['peak_rss_kb']:8} KB",
+                      file=sys.stderr)
+
+    return {"repetitions": args.repetitions, "results": results}
+
+
+def compare(report, baseline, threshold):
+    """Print how each median changed since baseline, returning the regressions."""
+    before = {(r["workload"], r["mode"]): r for r in baseline["results"]}
+    regressions = []
+
+    for result in report["results"]:
+        key = (result["workload"], result["mode"])
+        if key not in before:
+            continue
+
+        old = before[key]["wall_seconds"]["median"]
+        new = result["wall_seconds"]["median"]
+        change = (new - old) / old if old > 0 else 0.0
+        regressed = change > threshold
+
+        if regressed:
+            regressions.append(key)
+
+        print(f"{key[0]:20} {key[1]:12} {old:8.4f}s -> {new:8.4f}s {change:+7.1%}"
+              f"{'  REGRESSION' if regressed else ''}", file=sys.stderr)
+
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--nickel", default=DEFAULT_NICKEL, help="the nickel executable to benchmark")
+    parser.add_argument("--modes", nargs="+", default=DEFAULT_MODES,
+                        help="evaluation modes to run, without their leading dashes")
+    parser.add_argument("--workloads", nargs="+", help="only run these workloads")
+    parser.add_argument("--repetitions", type=int, default=5, help="runs of each workload in each mode")
+    parser.add_argument("--output", help="write the JSON report here, rather than to stdout")
+    parser.add_argument("--baseline", help="compare against the JSON report of an earlier run")
+    parser.add_argument("--threshold", type=float, default=0.1,
+                        help="the fractional slowdown of a median that counts as a regression")
+    args = parser.parse_args()
+
+    report = run(args)
+
+    if args.output:
+        with open(args.output, "w", encoding="utf-8") as file:
+            json.dump(report, file, indent=2)
+            file.write("\n")
+    else:
+        json.dump(report, sys.stdout, indent=2)
+        print()
+
+    if args.baseline:
+        with open(args.baseline, encoding="utf-8") as file:
+            regressions = compare(report, json.load(file), args.threshold)
+
+        if regressions:
+            print(f"{len(regressions)} regression(s) beyond {args.threshold:.0%}", file=sys.stderr)
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,17 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include "jit.h"
+#include "syntax.h"
+
+// Compile p ahead of time into a relocatable object file, whose main function
+// runs the program.
+void emit_object(struct program *p, const char *path, const struct jit_options *options);
+
+#define RUNTIME_LIBRARY "libnickelrt.a"
+
+// Compile p ahead of time into an executable, linked with the runtime library
+// by the system C compiler ($CC, or cc by default).
+void emit_executable(struct program *p, const char *path, const struct jit_options *options);
+
+#endif /* AOT_H */
@@ -0,0 +1,26 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// A bump allocator: allocations are carved sequentially out of large zeroed
+// chunks, and are only ever released all at once by arena_free.
+struct arena_chunk {
+    struct arena_chunk *prev;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+struct arena {
+    struct arena_chunk *chunk;
+    size_t allocated;
+};
+
+void *arena_alloc(struct arena *arena, size_t size);
+char *arena_strndup(struct arena *arena, const char *s, size_t len);
+void arena_free(struct arena *arena);
+
+#define arena_new(arena, type) ((type *)arena_alloc(arena, sizeof(type)))
+
+#endif /* ARENA_H */
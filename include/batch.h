@@ -0,0 +1,57 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "source.h"
+
+// Separates the programs of a batch read from a single stream, on a line of
+// its own. No program can contain a %.
+#define BATCH_DELIMITER "%%"
+
+struct batch_program {
+    char *name;
+    struct source source;
+    // What the program printed, and the errors that it reported, once done.
+    char *output;
+    size_t output_length;
+    char *errors;
+    size_t errors_length;
+    int status;
+    bool done;
+};
+
+// Run source, returning an exit status as main would. Called on a worker
+// thread, whose output and errors are captured for the program.
+typedef int (*batch_runner)(void *context, struct source *source);
+
+struct batch {
+    struct batch_program *programs;
+    unsigned long count;
+    unsigned long capacity;
+    batch_runner run;
+    void *context;
+    // The next program for a worker to take, and the lock (and condition)
+    // under which workers mark programs done.
+    unsigned long next;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+};
+
+void batch_init(struct batch *batch, batch_runner run, void *context);
+void batch_free(struct batch *batch);
+
+void batch_add_file(struct batch *batch, const char *path);
+// Add each program of file, separated by BATCH_DELIMITER lines.
+void batch_add_stream(struct batch *batch, FILE *file, const char *name);
+
+// Run every program of batch on jobs worker threads. Each program's output is
+// written to stdout, and its errors to stderr, after a header naming it and in
+// the order that the programs were added, as soon as it and every program
+// before it are done. Returns the number of programs that failed.
+unsigned long batch_run(struct batch *batch, unsigned long jobs);
+
+#endif /* BATCH_H */
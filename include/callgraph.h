@@ -0,0 +1,46 @@
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+
+#include "syntax.h"
+
+// Call visit(call, data) for every CALL within expr (including those nested in
+// the arguments of other calls). expr must have been resolved.
+void visit_calls(struct expr *expr, void (*visit)(struct call *call, void *data), void *data);
+
+// The calls between the functions of a program, built once so that analyses
+// of them run in time linear in the number of functions and calls. Functions
+// are numbered by index, and each is listed once per call: the callees of the
+// function numbered i are callees[callee_starts[i]] up to (but excluding)
+// callees[callee_starts[i + 1]], and its callers likewise.
+struct call_graph {
+    unsigned long func_count;
+    struct func **funcs;
+    unsigned long *callee_starts;
+    struct func **callees;
+    unsigned long *caller_starts;
+    struct func **callers;
+};
+
+// Build the call graph of p, which must have been resolved.
+void call_graph_init(struct call_graph *graph, struct program *p);
+void call_graph_free(struct call_graph *graph);
+
+// Set recursive[i] for each function (numbered by index) that can call itself,
+// directly or through others: one that calls itself, or that shares a
+// strongly connected component of the graph with another function.
+void find_recursive_funcs(struct call_graph *graph, bool *recursive);
+
+// Set the pure flag of each function in p: a function is pure when neither its
+// body, nor the body of any function that it can (transitively) call, contains
+// a PUTS. Also set the terminates flag: a function terminates when it cannot
+// (transitively) call itself, nor any function that can, so every call of it
+// returns. p must have been resolved.
+void analyse_purity(struct program *p);
+
+// Set the readnone flag of each function in p: a function is readnone when it
+// is pure, and neither it nor any function that it can (transitively) call
+// has a memo table, profile record or slot, which its calls read or write.
+// Call it once those are set, and after analyse_purity.
+void analyse_readnone(struct program *p);
+
+#endif /* CALLGRAPH_H */
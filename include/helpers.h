@@ -1,13 +1,29 @@
 #ifndef HELPERS_H
 #define HELPERS_H
 
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
 #define die(fmt, ...) do { \
-    fprintf(stderr, fmt, ##__VA_ARGS__); /* Flawfinder: ignore */ \
-    fprintf(stderr, "\n"); \
-    exit(1); \
-    __builtin_unreachable(); \
+    fprintf(error_stream(), fmt, ##__VA_ARGS__); /* Flawfinder: ignore */ \
+    fprintf(error_stream(), "\n"); \
+    fail(); \
 } while (0)
 
+// Errors in a program are reported to error_stream, and then fail. By default
+// that is stderr and then exit(1), but a thread may redirect its errors and
+// have fail longjmp to a target of its own instead, as batch workers do to
+// carry on with their next program. Code that sets a target within another's
+// scope restores the previous one when it is done.
+FILE *error_stream(void);
+void set_error_stream(FILE *stream);
+_Noreturn void fail(void);
+jmp_buf *current_fail_target(void);
+void set_fail_target(jmp_buf *target);
+
 #define checked_calloc(type, name) \
     type *name = calloc(1, sizeof(type)); \
     if (name == NULL) { die("calloc failure"); }
@@ -20,5 +36,12 @@ struct link {
 #define next_entry(name, type) (type *)((struct link *)name)->next
 
 unsigned long linked_list_count(struct link *head);
+unsigned long hash_bytes(const void *data, size_t length);
+// Whether text is nothing but whitespace.
+bool is_blank(const char *text, size_t length);
+
+// Start a thread running run(arg), with as large a stack as the main thread's,
+// which the interpreter and code generator assume when recursing.
+void start_thread(pthread_t *thread, void *(*run)(void *), void *arg);
 
 #endif /* HELPERS_H */
@@ -4,21 +4,51 @@
 #include "helpers.h"
 #include "syntax.h"
 
-struct stack_frame {
-    struct link link;
-    struct ident *func_ident;
-    struct var_binding {
-        struct link link;
-        struct ident *var_name;
-        unsigned long var_value;
-    } *var_binding;
+#define DEFAULT_MAX_DEPTH 100000UL
+
+// A function compiled by a faster execution tier, taking its arguments laid
+// out as they are in an interpreter frame.
+typedef long (*native_func)(long *args);
+
+// Counts interpreted calls of each function (by index), handing a function to
+// compile once it has been called threshold times. Later calls of a function
+// that compiled successfully run its native code.
+struct tiering {
+    unsigned long threshold;
+    unsigned long *call_counts;
+    native_func *native_funcs;
+    native_func (*compile)(void *compiler, struct func *func);
+    void *compiler;
 };
 
+// Calls evaluate their arguments straight onto a single preallocated value
+// stack; a function's frame is just the position of its first argument, with
+// room for its let bindings after its arguments, and variables are read from
+// the slots assigned by resolve_program.
 struct environment {
-    struct stack_frame *stack_frame;
-    struct definition_entry *head_definition_entry;
+    long *stack;
+    long *stack_end;
+    long *frame;
+    long *top;
+    unsigned long depth;
+    unsigned long max_depth;
+    // Counted for --stats: calls interpreted (including tail calls), and the
+    // deepest that they nested.
+    unsigned long calls;
+    unsigned long deepest;
+    // Calls nest on the native stack too, so guard that, rather than letting
+    // a deep recursion segfault.
+    char *native_stack_limit;
+    // NULL unless running in tiered mode.
+    struct tiering *tiering;
 };
 
+void init_environment(struct environment *env, struct program *p, unsigned long max_depth);
+void free_environment(struct environment *env);
+
 long interpret_expr(struct environment *env, struct expr *expr);
+// Call func with args (func->param_count of them) from a fresh stack, on
+// whichever thread env is now used by.
+long interpret_function(struct environment *env, struct func *func, const long *args);
 
 #endif /* INTERPRETER_H */
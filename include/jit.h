@@ -1,13 +1,111 @@
 #ifndef JIT_H
 #define JIT_H
 
+#include <stdbool.h>
+
 #include <llvm-c/Core.h>
+#include <llvm-c/ExecutionEngine.h>
+#include <llvm-c/TargetMachine.h>
 
 #include "helpers.h"
 #include "syntax.h"
 
-LLVMValueRef jit_expr(LLVMModuleRef mod, LLVMBuilderRef builder, LLVMValueRef func, struct expr *expr);
+// How code is optimised and generated.
+struct jit_options {
+    // 0 to 3, as for -O0 to -O3.
+    unsigned opt_level;
+    // 0, or 1 for -Os, or 2 for -Oz.
+    unsigned size_level;
+    unsigned inline_threshold;
+    LLVMCodeGenOptLevel codegen_level;
+    bool fast_isel;
+    // Generate code for the host CPU and its features, rather than a generic
+    // CPU of the host's architecture.
+    bool host_cpu;
+    bool new_pass_manager;
+    // Have the main function of code compiled ahead of time write each line
+    // of output as soon as it is printed.
+    bool unbuffered_output;
+    // Write the symbols of JIT-compiled code to /tmp/perf-<pid>.map. This
+    // does not change the code.
+    bool perf_map;
+};
+
+#define DEFAULT_JIT_OPTIONS { 3, 0, 225, LLVMCodeGenLevelDefault, false, false, false, false, false }
+
+// Functions of this process that generated code may call, by name.
+struct jit_runtime_symbol {
+    const char *name;
+    void (*address)(void);
+};
+
+extern const struct jit_runtime_symbol jit_runtime_symbols[];
+extern const unsigned long jit_runtime_symbol_count;
+
+// Set the new pass manager's inliner threshold. It is a process-wide LLVM
+// option, which can only be parsed once, so this must be called exactly once,
+// at startup, before anything is compiled.
+void jit_set_inline_threshold(unsigned threshold);
+
+// Describe options in buffer, e.g. for keying cached objects.
+void describe_jit_options(const struct jit_options *options, char *buffer, size_t size);
+
+// The context that the calling thread builds modules in (created on first
+// use), so that threads can compile at once. A thread disposes of its context
+// once it has disposed of every module and engine built in it.
+LLVMContextRef jit_context(void);
+void jit_dispose_context(void);
+
+// Code is generated into the context of whichever module it is added to.
+LLVMTypeRef jit_int64_type(LLVMModuleRef mod);
+
+// The SSA values of the let bindings in scope, innermost first. Variables in
+// other slots are func's parameters.
+struct jit_scope {
+    unsigned long slot;
+    LLVMValueRef value;
+    struct jit_scope *outer;
+};
+
+LLVMValueRef jit_expr(LLVMModuleRef mod, LLVMBuilderRef builder, LLVMValueRef func, struct jit_scope *scope,
+                      struct expr *expr);
+void jit_tail_expr(LLVMModuleRef mod, LLVMBuilderRef builder, LLVMValueRef func, struct jit_scope *scope,
+                   struct expr *expr, bool profiled);
+
+void declare_functions(LLVMModuleRef mod, struct definition_entry *definition_entry);
+void jit_declare_definition_entry(LLVMModuleRef mod, struct definition_entry *definition_entry);
+void jit_define_definition_entry(LLVMModuleRef mod, struct definition_entry *definition_entry);
+void declare_puts(LLVMModuleRef mod);
+void jit_expr_into_anonymous_function(LLVMModuleRef mod, struct expr *expr);
+// Call a Nickel function, or a pointer to one, in its calling convention.
+LLVMValueRef jit_build_call(LLVMBuilderRef builder, LLVMValueRef callee, LLVMValueRef *args,
+                            unsigned long arg_count, const char *name);
+// Add `long name(long *args)`, which calls func with the arguments laid out as
+// they are in an interpreter frame.
+void jit_frame_entry(LLVMModuleRef mod, struct func *func, const char *name);
+// Add `long name(long, ...)`, which calls func with the C calling convention.
+void jit_native_entry(LLVMModuleRef mod, struct func *func, const char *name);
+
+void verify_module(LLVMModuleRef mod);
+// target_machine, if not NULL, tells the optimisers about the target (its
+// vector registers, say) that mod will be compiled for.
+void apply_optimisation_passes(LLVMModuleRef mod, LLVMTargetMachineRef target_machine,
+                               const struct jit_options *options);
+LLVMExecutionEngineRef create_execution_engine(LLVMModuleRef mod, const struct jit_options *options);
+
+// Build p into a module in which only __anon_tl is external.
+LLVMModuleRef jit_build_module(struct program *p);
+void jit_optimise_module(LLVMModuleRef mod, LLVMTargetMachineRef target_machine, const struct jit_options *options);
+LLVMTargetMachineRef create_host_target_machine(const struct jit_options *options);
+// Set mod's triple and data layout to target_machine's, before optimising it.
+void jit_set_target(LLVMModuleRef mod, LLVMTargetMachineRef target_machine);
+// Generate a relocatable object from mod, which has been targeted.
+LLVMMemoryBufferRef jit_emit_object(LLVMModuleRef mod, LLVMTargetMachineRef target_machine);
+
+// Compile p to a relocatable object for the host, defining __anon_tl, and
+// optionally a main function that calls it.
+LLVMMemoryBufferRef jit_compile_object(struct program *p, bool with_main, const struct jit_options *options);
 
-void jit(struct program *p);
+void jit(struct program *p, const struct jit_options *options);
 
 #endif /* JIT_H */
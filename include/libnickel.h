@@ -0,0 +1,51 @@
+#ifndef LIBNICKEL_H
+#define LIBNICKEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The API of libnickel.a, for embedding Nickel in another program: compile a
+// program once, then call its functions as often as needed, from any number
+// of threads at once.
+
+enum nickel_engine { NICKEL_JIT, NICKEL_INTERPRETER };
+
+struct nickel;
+struct nickel_function;
+
+// Compile the definitions of source, which needs no top-level expression (and
+// any that it has is not run). Returns NULL if source is not a valid program,
+// setting *error (if error is not NULL) to why, for the caller to free.
+struct nickel *nickel_compile(const char *source, size_t length, enum nickel_engine engine, char **error);
+
+// Release nickel, once no thread is calling, or going to call, its functions.
+void nickel_release(struct nickel *nickel);
+
+// The function of nickel named name (the first, if it is defined more than
+// once), or NULL if there is none. It lasts as long as nickel, so can be
+// looked up once and then called any number of times.
+const struct nickel_function *nickel_lookup(struct nickel *nickel, const char *name);
+
+unsigned long nickel_param_count(const struct nickel_function *function);
+
+// The function's native code, or NULL if nickel is interpreted. Cast it to a
+// function of nickel_param_count int64_t parameters that returns int64_t, e.g.
+// `int64_t (*)(int64_t, int64_t)`, to call it directly. A thread that only
+// calls native code directly must call nickel_flush before it exits, or lose
+// what it printed (see nickel_flush).
+void *nickel_native(const struct nickel_function *function);
+
+// Call function with args (nickel_param_count of them), storing its result in
+// *result. Works with either engine. Returns false if the call failed, as an
+// interpreted call can by recursing too deeply, setting *error (if error is
+// not NULL) to why, for the caller to free.
+bool nickel_call(const struct nickel_function *function, const int64_t *args, int64_t *result, char **error);
+
+// Each thread collects what its calls print in a buffer of its own, which is
+// written out to stdout when it fills, when a thread that has used nickel_call
+// exits, and when the process exits. Write out the calling thread's buffer
+// now.
+void nickel_flush(void);
+
+#endif /* LIBNICKEL_H */
@@ -0,0 +1,24 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "jit.h"
+#include "syntax.h"
+
+// Inputs are read, and results written, this many calls at a time.
+#define MAP_CHUNK_CALLS 4096UL
+
+// Call the function of p named name once per tuple of arguments read from
+// input, writing each result to output. Tuples are either lines of integers
+// (separated by spaces, tabs or commas) or, if binary, consecutive native
+// 64-bit integers, and results are written in the same form.
+//
+// The calls are made by a loop compiled along with p, over a chunk of
+// arguments at a time, so the function can be inlined into it and (if the
+// function is simple enough) vectorised.
+void jit_map(struct program *p, const char *name, bool binary, FILE *input, FILE *output,
+             const struct jit_options *options);
+
+#endif /* MAP_H */
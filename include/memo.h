@@ -0,0 +1,38 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "syntax.h"
+
+#define DEFAULT_MEMO_CAPACITY 4096UL
+
+// A bounded, direct-mapped cache of a pure function's results, keyed on its
+// arguments: a new result replaces whichever entry its arguments hash to.
+struct memo_table {
+    unsigned long param_count;
+    // The capacity (a power of two) minus one.
+    unsigned long mask;
+    // Each entry is param_count + 2 longs: whether it is in use, the result,
+    // then the arguments.
+    long *entries;
+    unsigned long used;
+    unsigned long hits;
+    unsigned long misses;
+};
+
+// Create a table with capacity entries (rounded up to a power of two) for
+// each pure function of p that makes a call other than a tail call. p must
+// have been resolved.
+void memo_init(struct program *p, unsigned long capacity);
+void memo_free(struct program *p);
+
+// Print the hit rate and memory use of each table to stream.
+void memo_report(struct program *p, FILE *stream);
+
+// Called by the interpreter, and by generated code.
+bool nickel_memo_lookup(struct memo_table *table, const long *args, long *result);
+void nickel_memo_store(struct memo_table *table, const long *args, long result);
+
+#endif /* MEMO_H */
@@ -0,0 +1,18 @@
+#ifndef MUSTTAIL_H
+#define MUSTTAIL_H
+
+#include <llvm-c/Core.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Mark call as a musttail call. LLVM's C API (before LLVM 18) can only mark a
+// call as a tail call, which the optimiser is free to ignore.
+void jit_set_musttail(LLVMValueRef call);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MUSTTAIL_H */
@@ -0,0 +1,34 @@
+#ifndef OBJECT_CACHE_H
+#define OBJECT_CACHE_H
+
+#include <stdbool.h>
+
+#include <llvm-c/Core.h>
+
+#include "jit.h"
+#include "source.h"
+
+// A persistent cache of compiled objects, keyed on the program source, the
+// compilation settings, the host CPU and the LLVM version. Each entry is a
+// file in dir named by a hash of its key, and stores the full key so that a
+// hash collision can never produce the wrong program.
+struct object_cache {
+    const char *dir;
+    char *key;
+    size_t key_length;
+    char *path;
+};
+
+void object_cache_init(struct object_cache *cache, const char *dir, struct source *source,
+                       const struct jit_options *options);
+void object_cache_free(struct object_cache *cache);
+
+// Returns the cached object, or NULL on a miss.
+LLVMMemoryBufferRef object_cache_lookup(struct object_cache *cache);
+void object_cache_store(struct object_cache *cache, LLVMMemoryBufferRef object);
+
+// Add a hit or a miss to the counters kept in the cache directory, returning
+// the updated totals.
+void object_cache_count(struct object_cache *cache, bool hit, unsigned long *hits, unsigned long *misses);
+
+#endif /* OBJECT_CACHE_H */
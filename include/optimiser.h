@@ -0,0 +1,24 @@
+#ifndef OPTIMISER_H
+#define OPTIMISER_H
+
+#include "syntax.h"
+
+// Calls of non-recursive functions whose bodies have at most this many nodes
+// are inlined.
+#define INLINE_MAX_NODES 16UL
+
+struct optimiser_report {
+    unsigned long nodes_before;
+    unsigned long nodes_after;
+};
+
+unsigned long count_program_nodes(struct program *p);
+
+// Rewrite p (which must have been resolved) into a simpler but equivalent
+// program, for every backend: BINOPs of constants are folded, CONDITIONALs
+// with constant conditions are replaced by the arm that they would evaluate,
+// and calls of small non-recursive functions are inlined. New nodes are
+// allocated in p->arena.
+void optimise_program(struct program *p, struct optimiser_report *report);
+
+#endif /* OPTIMISER_H */
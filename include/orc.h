@@ -0,0 +1,26 @@
+#ifndef ORC_H
+#define ORC_H
+
+#include <llvm-c/LLJIT.h>
+
+#include "jit.h"
+#include "syntax.h"
+
+// Create an LLJIT whose code can call functions from this process.
+LLVMOrcLLJITRef orc_create_jit(const struct jit_options *options);
+void orc_check(LLVMErrorRef error, const char *what);
+// Verify mod and add it to jit's main dylib.
+void orc_add_module(LLVMOrcLLJITRef jit, LLVMOrcThreadSafeContextRef ts_context, LLVMModuleRef mod);
+// Optimise each module added to jit just before it is compiled.
+void orc_optimise_on_compile(LLVMOrcLLJITRef jit, const struct jit_options *options);
+
+// Evaluate p with ORC's LLJIT, compiling each function lazily, the first time
+// that it is called.
+void orc(struct program *p, const struct jit_options *options);
+
+// Link object (taking ownership of it) and run its __anon_tl.
+void orc_run_object(LLVMMemoryBufferRef object, const struct jit_options *options);
+// Link objects together (taking ownership of them) and run their __anon_tl.
+void orc_run_objects(LLVMMemoryBufferRef *objects, unsigned long count, const struct jit_options *options);
+
+#endif /* ORC_H */
@@ -1,26 +1,59 @@
 #ifndef PARSER_HELPERS_H
 #define PARSER_HELPERS_H
 
+#include <stdbool.h>
 #include <stdlib.h>
+#include "arena.h"
 #include "interpreter.h"
+#include "symbol_table.h"
 
 #define declare_expr_of_type(expr_type) \
-  checked_calloc(struct expr, expr); \
+  struct expr *expr = arena_new(arena, struct expr); \
   expr->type = expr_type
 
-struct ident *on_ident(char *name);
+// Parse a program from source. Every node of the resulting program (and the
+// program itself) lives in p->arena, so free_program releases it all at once.
+// Returns NULL if the program could not be parsed.
+struct program *parse_program(const char *source, size_t length);
+// As parse_program, but the top-level expression may be left out (leaving
+// p->expr NULL), for when only the program's definitions are used.
+struct program *parse_definitions(const char *source, size_t length);
+// As parse_program (or, if !needs_expr, parse_definitions), but scanning
+// source where it is rather than copying it first. The lexer writes to source
+// while it scans it, and needs it followed by SOURCE_PADDING NUL bytes, as the
+// text of a struct source is.
+struct program *parse_in_place(char *source, size_t length, bool needs_expr);
+void free_program(struct program *p);
+// Parse a submission to a session, which is a program whose top-level
+// expression (p->expr) may be NULL. Its nodes are allocated in arena, and its
+// identifiers interned in symbols, which the session keeps for all of its
+// submissions; the program must not be freed.
+struct program *parse_submission(const char *source, size_t length, struct arena *arena,
+                                 struct symbol_table *symbols);
 
-struct expr *on_literal(unsigned long value);
-struct expr *on_binop(enum binop_type type, struct expr *l, struct expr *r);
-struct expr *on_conditional(struct expr *cond, struct expr *on_true, struct expr *on_false);
-struct expr *on_puts(struct expr *body);
-struct expr *on_var(struct ident *ident);
-struct expr *on_func_call(struct ident *ident, struct arg_entry *arg_entries);
-struct func *on_func_def(struct ident *ident, struct param_entry *param_entries, struct expr *body);
-struct program *on_program(struct definition_entry *definition_entries, struct expr *main_expr);
+// Create a scanner of source, for yyparse. The scanner (like the parser) keeps
+// all of its state in itself, so any number of threads may parse at once. A
+// source longer than INT_MAX bytes is reported and fails.
+void *lex_create(const char *source, size_t length);
+// As lex_create, but scanning source in place (see parse_in_place).
+void *lex_create_in_place(char *source, size_t length);
+void lex_destroy(void *scanner);
 
-struct arg_entry *on_arg_entry(struct expr *value, struct arg_entry *next);
-struct param_entry *on_param_entry(struct ident *value, struct param_entry *next);
-struct definition_entry *on_definition_entry(struct func *value, struct definition_entry *next);
+// The value of an integer literal, which must fit in 64 bits.
+unsigned long parse_literal(const char *text, size_t length);
+
+struct expr *on_literal(struct arena *arena, unsigned long value);
+struct expr *on_binop(struct arena *arena, enum binop_type type, struct expr *l, struct expr *r);
+struct expr *on_conditional(struct arena *arena, struct expr *cond, struct expr *on_true, struct expr *on_false);
+struct expr *on_puts(struct arena *arena, struct expr *body);
+struct expr *on_var(struct arena *arena, struct ident *ident);
+struct expr *on_func_call(struct arena *arena, struct ident *ident, struct arg_entry *arg_entries);
+struct expr *on_let(struct arena *arena, struct ident *ident, struct expr *value, struct expr *body);
+struct func *on_func_def(struct arena *arena, struct ident *ident, struct param_entry *param_entries, struct expr *body);
+struct program *on_program(struct arena *arena, struct definition_entry *definition_entries, struct expr *main_expr);
+
+struct arg_entry *on_arg_entry(struct arena *arena, struct expr *value, struct arg_entry *next);
+struct param_entry *on_param_entry(struct arena *arena, struct ident *value, struct param_entry *next);
+struct definition_entry *on_definition_entry(struct arena *arena, struct func *value, struct definition_entry *next);
 
 #endif /* PARSER_HELPERS_H */
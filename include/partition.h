@@ -0,0 +1,14 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include "jit.h"
+#include "syntax.h"
+
+// Evaluate p as jit() does, but with its definitions split into (at most)
+// partitions parts, each built, optimised and compiled to an object on a
+// thread of its own. The objects are then linked together and run. Calls
+// between partitions cannot be inlined, and the functions that they call stay
+// in their partition's object even if every call within it is inlined.
+void jit_partitioned(struct program *p, unsigned long partitions, const struct jit_options *options);
+
+#endif /* PARTITION_H */
@@ -0,0 +1,23 @@
+#ifndef PERF_MAP_H
+#define PERF_MAP_H
+
+#include <llvm-c/ExecutionEngine.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A JIT event listener that appends the address, size and name of each
+// function that is loaded to /tmp/perf-<pid>.map, where perf looks for the
+// symbols of JIT-compiled code. LLVM's own perf listener writes jitdump files
+// instead (which need `perf inject`), and is only built into LLVM on request.
+LLVMJITEventListenerRef perf_map_listener(void);
+
+// MCJIT's C API offers no way to register a listener.
+void jit_register_event_listener(LLVMExecutionEngineRef engine, LLVMJITEventListenerRef listener);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PERF_MAP_H */
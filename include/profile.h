@@ -0,0 +1,33 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+
+#include "syntax.h"
+
+// Calls of a function, and the time spent in them: inclusive of the functions
+// that they call, and exclusive of them. A tail call ends the caller's time,
+// just as it ends the caller's frame.
+struct profile_record {
+    unsigned long calls;
+    unsigned long inclusive_ns;
+    unsigned long exclusive_ns;
+    // Calls in progress, so that the inclusive time of a recursive function
+    // is only counted by its outermost call.
+    unsigned long active;
+};
+
+// Create a record for each function of p, which must have been resolved.
+void profile_init(struct program *p);
+void profile_free(struct program *p);
+
+// Print the record of each function that was called to stream, those that
+// took the most exclusive time first.
+void profile_report(struct program *p, FILE *stream);
+
+// Called by the interpreter, and by generated code, on entering and leaving
+// a function.
+void nickel_profile_enter(struct profile_record *record);
+void nickel_profile_exit(void);
+
+#endif /* PROFILE_H */
@@ -0,0 +1,23 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <stdbool.h>
+
+#include "syntax.h"
+
+// Resolve every VAR in p to a parameter or let slot, and every CALL to its callee
+// definition, checking arities along the way. All problems are reported to
+// stderr; returns false if there were any. Only the first definition of a
+// name is kept in p->funcs, since it is the one that every call resolves to.
+bool resolve_program(struct program *p);
+
+// Find the definition of ident made by an earlier submission to a session, or
+// return NULL if there is none.
+typedef struct func *(*resolver_lookup)(void *context, const struct ident *ident);
+
+// Resolve a submission to a session as resolve_program does, but where calls
+// of functions that p does not define itself are resolved by lookup, and
+// where p->expr may be NULL.
+bool resolve_submission(struct program *p, resolver_lookup lookup, void *context);
+
+#endif /* RESOLVER_H */
@@ -0,0 +1,23 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// The runtime shared by every evaluation mode, and linked into executables
+// compiled ahead of time (as libnickelrt.a).
+
+// Print value and a newline to stdout, returning value. Output is collected in
+// a large buffer, which is written out when full, by nickel_flush, and when
+// the process exits. Each thread has its own buffer.
+long nickel_puts_i64(long value);
+
+// Write this thread's output to stream, or to stdout if stream is NULL.
+void nickel_capture_output(FILE *stream);
+
+// Write out each line as soon as it is printed, rather than buffering.
+void nickel_set_unbuffered(bool unbuffered);
+
+void nickel_flush(void);
+
+#endif /* RUNTIME_H */
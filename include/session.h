@@ -0,0 +1,20 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdio.h>
+
+#include "jit.h"
+
+// Evaluate each submission read from input, in a session that persists
+// between them. A submission is a run of lines up to a blank line (or the end
+// of input): any number of definitions, optionally followed by a top-level
+// expression to run.
+//
+// Each submission is compiled into a module of its own and added to one
+// long-lived LLJIT, so only its new code is compiled. Calls go through a slot
+// per function name, so redefining a function (with the same number of
+// parameters) replaces it for every caller, without recompiling them.
+// Returns the number of submissions that failed.
+unsigned long session(FILE *input, const struct jit_options *options);
+
+#endif /* SESSION_H */
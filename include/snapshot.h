@@ -0,0 +1,37 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+
+#include "syntax.h"
+
+// A snapshot is a binary image of a resolved (and optimised) program: its
+// definitions, function table, expression nodes and interned identifiers are
+// laid out exactly as in memory, but with every pointer stored as an offset
+// from the start of the image. Loading one maps the file, and turns those
+// offsets back into pointers in a single pass over its records, so it needs
+// no lexing, parsing, resolving or allocation.
+//
+// The records' layout depends on the build, so the image's header records
+// the format's version and the size of each record, and an image written by
+// an incompatible build is refused. Loading checks that every reference in
+// the image is to a record of the right kind, and later in the image than the
+// record that refers to it (so none loop), that every variable's slot is in
+// its function's frame, and that every call passes as many arguments as its
+// callee takes, so that a corrupt image is refused rather than run.
+struct snapshot {
+    void *image;
+    size_t length;
+};
+
+// Write the image of p (which must have been resolved) to path.
+void snapshot_write(struct program *p, const char *path);
+
+// Map the image at path, returning its program. The program lives in the
+// mapping, so stays valid until snapshot_free, and free_program releases
+// nothing of it. Its functions' pure and terminates flags are clear, for the
+// caller to find again with analyse_purity.
+struct program *snapshot_load(const char *path, struct snapshot *snapshot);
+void snapshot_free(struct snapshot *snapshot);
+
+#endif /* SNAPSHOT_H */
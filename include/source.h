@@ -0,0 +1,29 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// The NUL bytes that follow a source's text, so that the lexer can scan it in
+// place (flex needs two at the end of a buffer that it has not copied).
+#define SOURCE_PADDING 2
+
+// The full text of a program, followed by SOURCE_PADDING NUL bytes.
+struct source {
+    char *text;
+    size_t length;
+    // Whether text is a private mapping of a file, rather than allocated.
+    bool mapped;
+};
+
+void read_source(FILE *file, struct source *source);
+// Map the file at path into memory, rather than reading it, which saves
+// copying large programs. Files that leave no room for the padding in their
+// last page are read instead.
+void map_source(const char *path, struct source *source);
+// Copy length bytes of text into source.
+void copy_source(const char *text, size_t length, struct source *source);
+void free_source(struct source *source);
+
+#endif /* SOURCE_H */
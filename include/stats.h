@@ -0,0 +1,58 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <llvm-c/ExecutionEngine.h>
+#include <llvm-c/Types.h>
+
+// Wall and CPU time are attributed to whichever phase is current; phase_switch
+// makes another phase current. Building turns the syntax tree into IR (or
+// bytecode), and codegen turns IR into machine code.
+enum phase {
+    PHASE_NONE,
+    PHASE_PARSE,
+    PHASE_AST_OPTIMISE,
+    PHASE_BUILD,
+    PHASE_VERIFY,
+    PHASE_OPTIMISE,
+    PHASE_CODEGEN,
+    PHASE_EXECUTE,
+    PHASE_COUNT
+};
+
+// Counters reported by --stats. Those that cost anything to collect are only
+// collected when enabled is set.
+struct stats {
+    bool enabled;
+    unsigned long source_bytes;
+    unsigned long parser_bytes;
+    unsigned long ast_nodes_parsed;
+    unsigned long ast_nodes_optimised;
+    unsigned long ir_instructions_before;
+    unsigned long ir_instructions_after;
+    unsigned long machine_code_bytes;
+    unsigned long calls;
+    unsigned long max_call_depth;
+};
+
+// Each thread keeps its own phase times and counters.
+extern _Thread_local struct stats stats;
+
+// Make phase current, returning the phase that was, so that a nested phase can
+// switch back to it.
+enum phase phase_switch(enum phase phase);
+
+void stats_count_calls(unsigned long calls, unsigned long max_call_depth);
+unsigned long count_ir_instructions(LLVMModuleRef mod);
+// The size of the executable sections of an object file.
+unsigned long count_code_bytes(LLVMMemoryBufferRef object);
+
+// An MCJIT memory manager that counts the machine code it is given.
+LLVMMCJITMemoryManagerRef create_counting_memory_manager(void);
+
+// Print every phase time and counter to stream, as text or as JSON.
+void stats_report(FILE *stream, bool json);
+
+#endif /* STATS_H */
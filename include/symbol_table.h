@@ -0,0 +1,25 @@
+#ifndef SYMBOL_TABLE_H
+#define SYMBOL_TABLE_H
+
+#include <stddef.h>
+
+#include "arena.h"
+#include "syntax.h"
+
+// Interns the identifiers of a program as it is lexed, so that every
+// occurrence of a name shares one struct ident (allocated in the program's
+// arena), and identifiers can be compared by pointer.
+struct symbol_table {
+    struct arena *arena;
+    unsigned long count;
+    unsigned long capacity;
+    struct symbol *symbols;
+};
+
+void symbol_table_init(struct symbol_table *table, struct arena *arena);
+// Free the table itself; the idents it interned live on in the arena.
+void symbol_table_free(struct symbol_table *table);
+
+struct ident *intern(struct symbol_table *table, const char *name, size_t length);
+
+#endif /* SYMBOL_TABLE_H */
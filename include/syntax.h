@@ -1,18 +1,26 @@
 #ifndef SYNTAX_H
 #define SYNTAX_H
 
+#include <stdbool.h>
+
+#include "arena.h"
 #include "helpers.h"
 
+struct memo_table;
+struct profile_record;
+
 struct definition_entry { struct link link; struct func *value; };
 
 struct ident { char *name; };
 struct arg_entry { struct link link; struct expr *value; };
 
 struct expr {
-    enum expr_type { LITERAL, VAR, BINOP, CONDITIONAL, PUTS, CALL } type;
+    enum expr_type { LITERAL, VAR, BINOP, CONDITIONAL, PUTS, CALL, LET } type;
     union {
         unsigned long literal;
-        struct ident *var;
+        // slot is the index of the parameter in the enclosing function, or of
+        // the let binding after them, filled in by resolve_program.
+        struct var { struct ident *ident; unsigned long slot; } var;
         struct binop {
             enum binop_type { PLUS, MULT, LSHIFT, MINUS, LE, EQ } type;
             struct expr *l;
@@ -20,12 +28,43 @@ struct expr {
         } binop;
         struct conditional { struct expr *cond; struct expr *on_true; struct expr *on_false; } conditional;
         struct puts { struct expr *body; } puts;
-        struct call { struct ident *callee; struct arg_entry *args; } call;
+        // func is the callee definition, filled in by resolve_program.
+        struct call { struct ident *callee; struct arg_entry *args; struct func *func; } call;
+        // value is evaluated once, before body, which sees it as ident. slot
+        // follows the enclosing function's parameters and any enclosing lets,
+        // filled in by resolve_program.
+        struct let { struct ident *ident; struct expr *value; struct expr *body; unsigned long slot; } let;
     };
 };
 
 struct param_entry { struct link link;  struct ident *value; };
-struct func { struct ident *ident; struct param_entry* params; struct expr *body; };
-struct program { struct definition_entry *funcs; struct expr *expr; };
+// param_count, local_count (the most let bindings in scope at once) and index
+// (the position of the definition in the program) are filled in by
+// resolve_program, pure and terminates by analyse_purity, memo (which is NULL
+// unless the function's results are being memoised) by memo_init, profile
+// (which is NULL unless profiling) by profile_init, slot (which is NULL
+// unless calls go through the function pointer that it holds) by a session,
+// and readnone by analyse_readnone.
+struct func {
+    struct ident *ident;
+    struct param_entry* params;
+    struct expr *body;
+    unsigned long param_count;
+    unsigned long local_count;
+    unsigned long index;
+    bool pure;
+    bool terminates;
+    bool readnone;
+    struct memo_table *memo;
+    struct profile_record *profile;
+    void **slot;
+};
+// local_count is as for a func, but for expr.
+struct program {
+    struct definition_entry *funcs;
+    struct expr *expr;
+    unsigned long local_count;
+    struct arena arena;
+};
 
 #endif /* SYNTAX_H */
@@ -0,0 +1,15 @@
+#ifndef TIERING_H
+#define TIERING_H
+
+#include "interpreter.h"
+#include "jit.h"
+#include "syntax.h"
+
+#define DEFAULT_TIER_THRESHOLD 1000UL
+
+// Tiered evaluation starts by interpreting p, and JIT compiles each function
+// once the interpreter has called it threshold times.
+void tiered(struct program *p, unsigned long max_depth, unsigned long threshold,
+            const struct jit_options *options);
+
+#endif /* TIERING_H */
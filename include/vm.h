@@ -0,0 +1,52 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stddef.h>
+
+#include "syntax.h"
+
+// The VM is a stack machine: every instruction is a single long-sized opcode,
+// followed by its immediate operand (if it has one).
+enum vm_opcode {
+    OP_CONST,        // push the immediate
+    OP_LOAD,         // push the frame slot named by the immediate
+    OP_NIP,          // drop the value under the top of the stack
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_SHL,
+    OP_LE,
+    OP_EQ,
+    OP_JUMP,         // jump to the immediate code offset
+    OP_JUMP_IF_ZERO, // pop, and jump to the immediate code offset if zero
+    OP_PUTS,         // print the top of the stack, leaving it in place
+    OP_CALL,         // call the function whose index is the immediate
+    OP_TAIL_CALL,    // replace the current call with a call of the function
+                     // whose index is the immediate
+    OP_RET,          // return the top of the stack to the caller
+    OP_HALT,
+};
+
+struct vm_func {
+    size_t entry;
+    unsigned long param_count;
+    // The most values the function can have on the stack at once, including
+    // its arguments; checked on entry so that pushes need no bounds check.
+    unsigned long max_height;
+};
+
+struct vm_program {
+    long *code;
+    size_t code_length;
+    size_t code_capacity;
+    struct vm_func *funcs;
+    unsigned long func_count;
+    size_t main_entry;
+    unsigned long main_max_height;
+};
+
+struct vm_program *vm_compile(struct program *p);
+void vm_run(struct vm_program *vm_program, unsigned long max_depth);
+void vm_free(struct vm_program *vm_program);
+
+#endif /* VM_H */
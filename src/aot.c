@@ -0,0 +1,107 @@
+#include <errno.h>
+#include <limits.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "aot.h"
+#include "jit.h"
+#include "stats.h"
+
+extern char **environ;
+
+void write_object(LLVMMemoryBufferRef object, FILE *file, const char *path) {
+    size_t size = LLVMGetBufferSize(object);
+
+    if (stats.enabled) {
+        stats.machine_code_bytes += count_code_bytes(object);
+    }
+
+    if (fwrite(LLVMGetBufferStart(object), 1, size, file) != size || fclose(file) != 0) {
+        die("Failed to write %s: %s", path, strerror(errno));
+    }
+}
+
+void emit_object(struct program *p, const char *path, const struct jit_options *options) {
+    LLVMMemoryBufferRef object = jit_compile_object(p, true, options);
+
+    FILE *file = fopen(path, "wb"); /* Flawfinder: ignore */
+    if (file == NULL) {
+        die("Could not open %s: %s", path, strerror(errno));
+    }
+
+    write_object(object, file, path);
+
+    LLVMDisposeMemoryBuffer(object);
+}
+
+// The runtime library lives alongside the nickel executable, unless
+// $NICKEL_RUNTIME names it.
+void runtime_library_path(char *path, size_t size) {
+    char *runtime = getenv("NICKEL_RUNTIME"); /* Flawfinder: ignore */
+
+    if (runtime != NULL && runtime[0] != '\0') {
+        snprintf(path, size, "%s", runtime);
+        return;
+    }
+
+    ssize_t length = readlink("/proc/self/exe", path, size - 1); /* Flawfinder: ignore */
+    char *slash = length > 0 ? memrchr(path, '/', length) : NULL;
+
+    if (slash == NULL) {
+        snprintf(path, size, RUNTIME_LIBRARY);
+    } else {
+        snprintf(slash + 1, size - (slash + 1 - path), RUNTIME_LIBRARY);
+    }
+}
+
+int run_linker(const char *object_path, const char *path) {
+    char *cc = getenv("CC"); /* Flawfinder: ignore */
+    char runtime_path[PATH_MAX];
+
+    runtime_library_path(runtime_path, sizeof(runtime_path));
+
+    char *argv[] = {
+        cc != NULL && cc[0] != '\0' ? cc : "cc", "-o", (char *)path, (char *)object_path, runtime_path, NULL
+    };
+    pid_t pid;
+    int status;
+
+    int error = posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ);
+    if (error != 0) {
+        fprintf(stderr, "Could not run linker %s: %s\n", argv[0], strerror(error));
+        return 1;
+    }
+
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Linker %s failed\n", argv[0]);
+        return 1;
+    }
+
+    return 0;
+}
+
+void emit_executable(struct program *p, const char *path, const struct jit_options *options) {
+    LLVMMemoryBufferRef object = jit_compile_object(p, true, options);
+    char object_path[] = "/tmp/nickel-XXXXXX.o";
+
+    int fd = mkstemps(object_path, 2);
+    FILE *file = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (file == NULL) {
+        die("Could not create temporary object file: %s", strerror(errno));
+    }
+
+    write_object(object, file, object_path);
+    LLVMDisposeMemoryBuffer(object);
+
+    int link_result = run_linker(object_path, path);
+
+    unlink(object_path);
+
+    if (link_result != 0) {
+        exit(1);
+    }
+}
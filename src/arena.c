@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "helpers.h"
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+// Nothing allocated from an arena is more strictly aligned than a pointer.
+#define ARENA_ALIGNMENT sizeof(void *)
+
+void *arena_alloc(struct arena *arena, size_t size) {
+    struct arena_chunk *chunk = arena->chunk;
+
+    size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        size_t chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+
+        chunk = calloc(1, sizeof(struct arena_chunk) + chunk_size);
+        if (chunk == NULL) { die("calloc failure"); }
+
+        chunk->size = chunk_size;
+        chunk->prev = arena->chunk;
+        arena->chunk = chunk;
+    }
+
+    void *allocation = chunk->data + chunk->used;
+    chunk->used += size;
+    arena->allocated += size;
+
+    return allocation;
+}
+
+char *arena_strndup(struct arena *arena, const char *s, size_t len) {
+    char *copy = arena_alloc(arena, len + 1);
+
+    memcpy(copy, s, len); /* Flawfinder: ignore */
+
+    return copy;
+}
+
+void arena_free(struct arena *arena) {
+    struct arena_chunk *chunk = arena->chunk;
+
+    while (chunk != NULL) {
+        struct arena_chunk *prev = chunk->prev;
+        free(chunk);
+        chunk = prev;
+    }
+
+    arena->chunk = NULL;
+    arena->allocated = 0;
+}
@@ -0,0 +1,216 @@
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "helpers.h"
+#include "jit.h"
+#include "runtime.h"
+
+#define BATCH_INITIAL_CAPACITY 64
+
+void batch_init(struct batch *batch, batch_runner run, void *context) {
+    batch->programs = NULL;
+    batch->count = 0;
+    batch->capacity = 0;
+    batch->run = run;
+    batch->context = context;
+    batch->next = 0;
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->done, NULL);
+}
+
+void batch_free(struct batch *batch) {
+    for (unsigned long i = 0; i < batch->count; i++) {
+        free(batch->programs[i].name);
+        free(batch->programs[i].output);
+        free(batch->programs[i].errors);
+        free_source(&batch->programs[i].source);
+    }
+
+    free(batch->programs);
+    pthread_cond_destroy(&batch->done);
+    pthread_mutex_destroy(&batch->lock);
+}
+
+// Add a program named name, taking ownership of source.
+void batch_add(struct batch *batch, char *name, struct source source) {
+    if (batch->count == batch->capacity) {
+        batch->capacity = batch->capacity > 0 ? batch->capacity * 2 : BATCH_INITIAL_CAPACITY;
+        batch->programs = realloc(batch->programs, batch->capacity * sizeof(struct batch_program));
+        if (batch->programs == NULL) { die("realloc failure"); }
+    }
+
+    struct batch_program *program = &batch->programs[batch->count++];
+
+    memset(program, 0, sizeof(*program));
+    program->name = name;
+    program->source = source;
+}
+
+char *batch_strdup(const char *s) {
+    char *copy = strdup(s);
+    if (copy == NULL) { die("strdup failure"); }
+
+    return copy;
+}
+
+void batch_add_file(struct batch *batch, const char *path) {
+    struct source source;
+
+    map_source(path, &source);
+
+    batch_add(batch, batch_strdup(path), source);
+}
+
+void batch_add_stream(struct batch *batch, FILE *file, const char *name) {
+    struct source stream;
+    size_t delimiter_length = strlen(BATCH_DELIMITER); /* Flawfinder: ignore */
+    size_t start = 0;
+    unsigned long line = 1, start_line = 1;
+
+    read_source(file, &stream);
+
+    for (size_t position = 0; position <= stream.length; line++) {
+        const char *newline = memchr(stream.text + position, '\n', stream.length - position);
+        size_t end = newline != NULL ? (size_t)(newline - stream.text) : stream.length;
+        bool delimiter = end - position == delimiter_length &&
+                         memcmp(stream.text + position, BATCH_DELIMITER, delimiter_length) == 0;
+
+        size_t length = (delimiter ? position : stream.length) - start;
+
+        // A program runs up to a delimiter, or to the end of the stream (where
+        // a final delimiter may leave nothing).
+        if (delimiter || (newline == NULL && !is_blank(stream.text + start, length))) {
+            struct source source;
+            copy_source(stream.text + start, length, &source);
+
+            size_t name_length = strlen(name) + 32; /* Flawfinder: ignore */
+            char *program_name = malloc(name_length);
+            if (program_name == NULL) { die("malloc failure"); }
+            snprintf(program_name, name_length, "%s:%lu", name, start_line);
+
+            batch_add(batch, program_name, source);
+        }
+
+        if (delimiter) {
+            start = end + 1;
+            start_line = line + 1;
+        }
+
+        if (newline == NULL) {
+            break;
+        }
+
+        position = end + 1;
+    }
+
+    free_source(&stream);
+}
+
+// Run program on this thread, capturing its output and errors. A program that
+// dies is abandoned, along with whatever it had allocated.
+void batch_run_program(struct batch *batch, struct batch_program *program) {
+    FILE *output = open_memstream(&program->output, &program->output_length);
+    FILE *errors = open_memstream(&program->errors, &program->errors_length);
+    jmp_buf fail_target;
+
+    if (output == NULL || errors == NULL) {
+        die("open_memstream failure");
+    }
+
+    nickel_capture_output(output);
+    set_error_stream(errors);
+    set_fail_target(&fail_target);
+
+    if (setjmp(fail_target) == 0) {
+        program->status = batch->run(batch->context, &program->source);
+    } else {
+        program->status = 1;
+    }
+
+    set_fail_target(NULL);
+    set_error_stream(NULL);
+    nickel_capture_output(NULL);
+
+    fclose(output);
+    fclose(errors);
+    free_source(&program->source);
+}
+
+void *batch_worker(void *batch_ptr) {
+    struct batch *batch = batch_ptr;
+
+    while (true) {
+        pthread_mutex_lock(&batch->lock);
+        unsigned long index = batch->next < batch->count ? batch->next++ : batch->count;
+        pthread_mutex_unlock(&batch->lock);
+
+        if (index == batch->count) {
+            break;
+        }
+
+        batch_run_program(batch, &batch->programs[index]);
+
+        pthread_mutex_lock(&batch->lock);
+        batch->programs[index].done = true;
+        pthread_cond_broadcast(&batch->done);
+        pthread_mutex_unlock(&batch->lock);
+    }
+
+    jit_dispose_context();
+
+    return NULL;
+}
+
+void batch_write(const char *name, const char *text, size_t length, FILE *stream) {
+    fprintf(stream, "==> %s <==\n", name);
+    fwrite(text, 1, length, stream);
+    fflush(stream);
+}
+
+unsigned long batch_run(struct batch *batch, unsigned long jobs) {
+    unsigned long failures = 0;
+
+    if (jobs > batch->count) {
+        jobs = batch->count;
+    }
+
+    pthread_t workers[jobs > 0 ? jobs : 1];
+
+    for (unsigned long i = 0; i < jobs; i++) {
+        start_thread(&workers[i], batch_worker, batch);
+    }
+
+    for (unsigned long i = 0; i < batch->count; i++) {
+        struct batch_program *program = &batch->programs[i];
+
+        pthread_mutex_lock(&batch->lock);
+        while (!program->done) {
+            pthread_cond_wait(&batch->done, &batch->lock);
+        }
+        pthread_mutex_unlock(&batch->lock);
+
+        batch_write(program->name, program->output, program->output_length, stdout);
+
+        if (program->errors_length > 0) {
+            batch_write(program->name, program->errors, program->errors_length, stderr);
+        }
+
+        if (program->status != 0) {
+            failures++;
+        }
+
+        free(program->output);
+        free(program->errors);
+        program->output = program->errors = NULL;
+    }
+
+    for (unsigned long i = 0; i < jobs; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    return failures;
+}
@@ -0,0 +1,331 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "callgraph.h"
+
+void visit_calls(struct expr *expr, void (*visit)(struct call *call, void *data), void *data) {
+    struct arg_entry *arg_entry;
+
+    switch (expr->type) {
+        case LITERAL:
+        case VAR:
+            break;
+        case BINOP:
+            visit_calls(expr->binop.l, visit, data);
+            visit_calls(expr->binop.r, visit, data);
+            break;
+        case CONDITIONAL:
+            visit_calls(expr->conditional.cond, visit, data);
+            visit_calls(expr->conditional.on_true, visit, data);
+            visit_calls(expr->conditional.on_false, visit, data);
+            break;
+        case PUTS:
+            visit_calls(expr->puts.body, visit, data);
+            break;
+        case LET:
+            visit_calls(expr->let.value, visit, data);
+            visit_calls(expr->let.body, visit, data);
+            break;
+        case CALL:
+            visit(&expr->call, data);
+
+            arg_entry = expr->call.args;
+
+            while (arg_entry != NULL) {
+                visit_calls(arg_entry->value, visit, data);
+                arg_entry = next_entry(arg_entry, struct arg_entry);
+            }
+            break;
+    }
+}
+
+// Where call_graph_init is up to: the function whose body it is visiting, and
+// (once the edges have been counted) the next free place in each function's
+// lists.
+struct call_graph_builder {
+    struct call_graph *graph;
+    struct func *caller;
+    unsigned long *next_callee;
+    unsigned long *next_caller;
+};
+
+void count_call(struct call *call, void *builder_ptr) {
+    struct call_graph_builder *builder = builder_ptr;
+
+    builder->graph->callee_starts[builder->caller->index + 1]++;
+    builder->graph->caller_starts[call->func->index + 1]++;
+}
+
+void add_call(struct call *call, void *builder_ptr) {
+    struct call_graph_builder *builder = builder_ptr;
+
+    builder->graph->callees[builder->next_callee[builder->caller->index]++] = call->func;
+    builder->graph->callers[builder->next_caller[call->func->index]++] = builder->caller;
+}
+
+void *call_graph_alloc(unsigned long count, size_t size) {
+    void *array = calloc(count > 0 ? count : 1, size);
+    if (array == NULL) { die("calloc failure"); }
+
+    return array;
+}
+
+void call_graph_init(struct call_graph *graph, struct program *p) {
+    struct definition_entry *definition_entry;
+    struct call_graph_builder builder = { graph, NULL, NULL, NULL };
+    unsigned long n = linked_list_count((struct link *)p->funcs);
+
+    graph->func_count = n;
+    graph->funcs = call_graph_alloc(n, sizeof(struct func *));
+    graph->callee_starts = call_graph_alloc(n + 1, sizeof(unsigned long));
+    graph->caller_starts = call_graph_alloc(n + 1, sizeof(unsigned long));
+
+    for (definition_entry = p->funcs; definition_entry != NULL;
+         definition_entry = next_entry(definition_entry, struct definition_entry)) {
+        builder.caller = definition_entry->value;
+        graph->funcs[builder.caller->index] = builder.caller;
+        visit_calls(builder.caller->body, count_call, &builder);
+    }
+
+    // Each function's count becomes where its list starts.
+    for (unsigned long i = 0; i < n; i++) {
+        graph->callee_starts[i + 1] += graph->callee_starts[i];
+        graph->caller_starts[i + 1] += graph->caller_starts[i];
+    }
+
+    graph->callees = call_graph_alloc(graph->callee_starts[n], sizeof(struct func *));
+    graph->callers = call_graph_alloc(graph->caller_starts[n], sizeof(struct func *));
+    builder.next_callee = call_graph_alloc(n, sizeof(unsigned long));
+    builder.next_caller = call_graph_alloc(n, sizeof(unsigned long));
+
+    for (unsigned long i = 0; i < n; i++) {
+        builder.next_callee[i] = graph->callee_starts[i];
+        builder.next_caller[i] = graph->caller_starts[i];
+    }
+
+    for (unsigned long i = 0; i < n; i++) {
+        builder.caller = graph->funcs[i];
+        visit_calls(builder.caller->body, add_call, &builder);
+    }
+
+    free(builder.next_callee);
+    free(builder.next_caller);
+}
+
+void call_graph_free(struct call_graph *graph) {
+    free(graph->funcs);
+    free(graph->callee_starts);
+    free(graph->callees);
+    free(graph->caller_starts);
+    free(graph->callers);
+}
+
+void find_recursive_funcs(struct call_graph *graph, bool *recursive) {
+    unsigned long n = graph->func_count;
+    // Tarjan's algorithm, with the depth-first search kept on a stack of its
+    // own rather than the native one, so that long chains of calls cannot
+    // overflow it. order is when each function was first visited (from 1, so
+    // that 0 is unvisited), low the earliest function on the component stack
+    // that it can reach, and next_callee where its search is up to.
+    unsigned long *order = call_graph_alloc(n, sizeof(unsigned long));
+    unsigned long *low = call_graph_alloc(n, sizeof(unsigned long));
+    unsigned long *next_callee = call_graph_alloc(n, sizeof(unsigned long));
+    unsigned long *component_position = call_graph_alloc(n, sizeof(unsigned long));
+    unsigned long *component_stack = call_graph_alloc(n, sizeof(unsigned long));
+    unsigned long *search = call_graph_alloc(n, sizeof(unsigned long));
+    bool *on_component_stack = call_graph_alloc(n, sizeof(bool));
+    unsigned long visited = 0, component_size = 0, search_depth = 0;
+
+    for (unsigned long root = 0; root < n; root++) {
+        if (order[root] != 0) {
+            continue;
+        }
+
+        order[root] = low[root] = ++visited;
+        next_callee[root] = graph->callee_starts[root];
+        component_position[root] = component_size;
+        component_stack[component_size++] = root;
+        on_component_stack[root] = true;
+        search[search_depth++] = root;
+
+        while (search_depth > 0) {
+            unsigned long v = search[search_depth - 1];
+
+            if (next_callee[v] < graph->callee_starts[v + 1]) {
+                unsigned long w = graph->callees[next_callee[v]++]->index;
+
+                if (w == v) {
+                    recursive[v] = true;
+                }
+
+                if (order[w] == 0) {
+                    order[w] = low[w] = ++visited;
+                    next_callee[w] = graph->callee_starts[w];
+                    component_position[w] = component_size;
+                    component_stack[component_size++] = w;
+                    on_component_stack[w] = true;
+                    search[search_depth++] = w;
+                } else if (on_component_stack[w] && order[w] < low[v]) {
+                    low[v] = order[w];
+                }
+
+                continue;
+            }
+
+            search_depth--;
+
+            if (search_depth > 0 && low[v] < low[search[search_depth - 1]]) {
+                low[search[search_depth - 1]] = low[v];
+            }
+
+            // v is the first of its component that was visited, so the
+            // component is everything above it on the component stack.
+            if (low[v] == order[v]) {
+                bool several = component_size - component_position[v] > 1;
+
+                while (component_size > component_position[v]) {
+                    unsigned long member = component_stack[--component_size];
+
+                    on_component_stack[member] = false;
+                    recursive[member] = recursive[member] || several;
+                }
+            }
+        }
+    }
+
+    free(order);
+    free(low);
+    free(next_callee);
+    free(component_position);
+    free(component_stack);
+    free(search);
+    free(on_component_stack);
+}
+
+bool contains_puts(struct expr *expr) {
+    struct arg_entry *arg_entry;
+
+    switch (expr->type) {
+        case LITERAL:
+        case VAR:
+            return false;
+        case BINOP:
+            return contains_puts(expr->binop.l) || contains_puts(expr->binop.r);
+        case CONDITIONAL:
+            return contains_puts(expr->conditional.cond) ||
+                   contains_puts(expr->conditional.on_true) ||
+                   contains_puts(expr->conditional.on_false);
+        case PUTS:
+            return true;
+        case LET:
+            return contains_puts(expr->let.value) || contains_puts(expr->let.body);
+        case CALL:
+            arg_entry = expr->call.args;
+
+            while (arg_entry != NULL) {
+                if (contains_puts(arg_entry->value)) {
+                    return true;
+                }
+                arg_entry = next_entry(arg_entry, struct arg_entry);
+            }
+
+            return false;
+    }
+}
+
+// Clear the flag (found at offset field of each struct func) of every function
+// that can, directly or through others, call one whose flag is already clear,
+// visiting each function and call once.
+void clear_in_callers(struct call_graph *graph, size_t field) {
+    unsigned long *worklist = call_graph_alloc(graph->func_count, sizeof(unsigned long));
+    unsigned long pending = 0;
+
+    for (unsigned long i = 0; i < graph->func_count; i++) {
+        if (!*(bool *)((char *)graph->funcs[i] + field)) {
+            worklist[pending++] = i;
+        }
+    }
+
+    while (pending > 0) {
+        unsigned long callee = worklist[--pending];
+
+        for (unsigned long j = graph->caller_starts[callee]; j < graph->caller_starts[callee + 1]; j++) {
+            bool *flag = (bool *)((char *)graph->callers[j] + field);
+
+            if (*flag) {
+                *flag = false;
+                worklist[pending++] = graph->callers[j]->index;
+            }
+        }
+    }
+
+    free(worklist);
+}
+
+// Set terminates on every function whose calls all (transitively) return,
+// starting from those that make no calls, and counting down each caller's
+// calls of functions not yet known to, so none on a cycle of calls is set.
+void find_terminating_funcs(struct call_graph *graph) {
+    unsigned long *worklist = call_graph_alloc(graph->func_count, sizeof(unsigned long));
+    unsigned long *unknown_calls = call_graph_alloc(graph->func_count, sizeof(unsigned long));
+    unsigned long pending = 0;
+
+    for (unsigned long i = 0; i < graph->func_count; i++) {
+        unknown_calls[i] = graph->callee_starts[i + 1] - graph->callee_starts[i];
+        graph->funcs[i]->terminates = unknown_calls[i] == 0;
+
+        if (graph->funcs[i]->terminates) {
+            worklist[pending++] = i;
+        }
+    }
+
+    while (pending > 0) {
+        unsigned long callee = worklist[--pending];
+
+        for (unsigned long j = graph->caller_starts[callee]; j < graph->caller_starts[callee + 1]; j++) {
+            struct func *caller = graph->callers[j];
+
+            if (--unknown_calls[caller->index] == 0) {
+                caller->terminates = true;
+                worklist[pending++] = caller->index;
+            }
+        }
+    }
+
+    free(unknown_calls);
+    free(worklist);
+}
+
+void analyse_purity(struct program *p) {
+    struct call_graph graph;
+
+    call_graph_init(&graph, p);
+
+    for (unsigned long i = 0; i < graph.func_count; i++) {
+        graph.funcs[i]->pure = !contains_puts(graph.funcs[i]->body);
+    }
+
+    clear_in_callers(&graph, offsetof(struct func, pure));
+    find_terminating_funcs(&graph);
+
+    call_graph_free(&graph);
+}
+
+void analyse_readnone(struct program *p) {
+    struct call_graph graph;
+
+    call_graph_init(&graph, p);
+
+    for (unsigned long i = 0; i < graph.func_count; i++) {
+        struct func *func = graph.funcs[i];
+
+        func->readnone = func->pure && func->memo == NULL && func->profile == NULL && func->slot == NULL;
+    }
+
+    // A caller declared readnone could have its calls removed, hoisted or
+    // merged, skipping the memo lookups or profile counts inside them.
+    clear_in_callers(&graph, offsetof(struct func, readnone));
+
+    call_graph_free(&graph);
+}
@@ -1,7 +1,41 @@
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <sys/resource.h>
 
 #include "helpers.h"
 
+// As the interpreter assumes, when the stack size is unlimited.
+#define DEFAULT_THREAD_STACK_SIZE (8 * 1024 * 1024)
+
+_Thread_local FILE *thread_error_stream;
+_Thread_local jmp_buf *thread_fail_target;
+
+FILE *error_stream(void) {
+    return thread_error_stream != NULL ? thread_error_stream : stderr;
+}
+
+void set_error_stream(FILE *stream) {
+    thread_error_stream = stream;
+}
+
+_Noreturn void fail(void) {
+    if (thread_fail_target != NULL) {
+        longjmp(*thread_fail_target, 1);
+    }
+
+    exit(1);
+}
+
+jmp_buf *current_fail_target(void) {
+    return thread_fail_target;
+}
+
+void set_fail_target(jmp_buf *target) {
+    thread_fail_target = target;
+}
+
 unsigned long linked_list_count(struct link *head) {
     unsigned long count = 0;
 
@@ -12,3 +46,45 @@ unsigned long linked_list_count(struct link *head) {
 
     return count;
 }
+
+bool is_blank(const char *text, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] != ' ' && text[i] != '\t' && text[i] != '\n') {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+unsigned long hash_bytes(const void *data, size_t length) {
+    // FNV-1a
+    const unsigned char *bytes = data;
+    unsigned long hash = 14695981039346656037UL;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211UL;
+    }
+
+    return hash;
+}
+
+void start_thread(pthread_t *thread, void *(*run)(void *), void *arg) {
+    pthread_attr_t attr;
+    struct rlimit rlimit;
+    size_t stack_size = DEFAULT_THREAD_STACK_SIZE;
+
+    if (getrlimit(RLIMIT_STACK, &rlimit) == 0 && rlimit.rlim_cur != RLIM_INFINITY) {
+        stack_size = rlimit.rlim_cur;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, stack_size);
+
+    if (pthread_create(thread, &attr, run, arg) != 0) {
+        die("pthread_create failure");
+    }
+
+    pthread_attr_destroy(&attr);
+}
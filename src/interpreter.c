@@ -1,9 +1,14 @@
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "interpreter.h"
+#include "memo.h"
+#include "profile.h"
+#include "runtime.h"
+#include "stats.h"
 
 long interpret_binop(struct environment *env, struct binop b) {
     long lval = interpret_expr(env, b.l);
@@ -34,119 +39,280 @@ long interpret_conditional(struct environment *env, struct conditional c) {
 }
 
 long interpret_puts(struct environment *env, struct puts p) {
-    long res = interpret_expr(env, p.body);
-
-    printf("%ld\n", res);
-
-    return res;
+    return nickel_puts_i64(interpret_expr(env, p.body));
 }
 
-bool equal_ident(struct ident *l, struct ident *r) {
-    return strcmp(l->name, r->name) == 0;
-}
+long interpret_let(struct environment *env, struct let l) {
+    env->frame[l.slot] = interpret_expr(env, l.value);
 
-long lookup_var(struct environment *env, struct ident *search_ident) {
-    struct stack_frame *stack_frame = env->stack_frame;
-    struct var_binding *var_binding = stack_frame->var_binding;
+    return interpret_expr(env, l.body);
+}
 
-    while (var_binding != NULL) {
-        if (equal_ident(var_binding->var_name, search_ident)) {
-            return var_binding->var_value;
+// Leave some headroom on the native stack for die(), or, on smaller stacks,
+// a quarter of it.
+#define NATIVE_STACK_MARGIN (256 * 1024)
+// Assumed to be free below the caller's frame, if a thread's stack cannot be
+// found.
+#define DEFAULT_NATIVE_STACK_SIZE (8 * 1024 * 1024)
+
+// The limit of the calling thread's native stack, found once per thread
+// (which, for the main thread, means reading /proc/self/maps).
+_Thread_local char *thread_native_stack_limit;
+
+// Guard the native stack of the calling thread, which may be any size.
+void set_native_stack_limit(struct environment *env) {
+    if (thread_native_stack_limit == NULL) {
+        pthread_attr_t attr;
+        void *stack;
+        size_t size;
+
+        if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+            if (pthread_attr_getstack(&attr, &stack, &size) == 0) {
+                size_t margin = size / 4 < NATIVE_STACK_MARGIN ? size / 4 : NATIVE_STACK_MARGIN;
+                thread_native_stack_limit = (char *)stack + margin;
+            }
+
+            pthread_attr_destroy(&attr);
         }
-
-        var_binding = next_entry(var_binding, struct var_binding);
     }
 
-    die("Could not find var %s in stack frame of %s!", search_ident->name, stack_frame->func_ident->name);
+    if (thread_native_stack_limit != NULL) {
+        env->native_stack_limit = thread_native_stack_limit;
+    } else {
+        env->native_stack_limit = (char *)__builtin_frame_address(0) - DEFAULT_NATIVE_STACK_SIZE + NATIVE_STACK_MARGIN;
+    }
 }
 
-struct func *lookup_func(struct environment *env, struct ident *search_ident) {
-    struct definition_entry *definition_entry = env->head_definition_entry;
+void init_environment(struct environment *env, struct program *p, unsigned long max_depth) {
+    unsigned long max_frame_size = 1;
+    struct definition_entry *definition_entry = p->funcs;
 
     while (definition_entry != NULL) {
-        if (equal_ident(definition_entry->value->ident, search_ident)) {
-            return definition_entry->value;
+        struct func *func = definition_entry->value;
+
+        if (func->param_count + func->local_count > max_frame_size) {
+            max_frame_size = func->param_count + func->local_count;
         }
 
         definition_entry = next_entry(definition_entry, struct definition_entry);
     }
 
-    die("Could not find func %s in env!", search_ident->name);
+    // Pages of the stack are only touched (and so only committed) as deep as
+    // the program actually recurses. The extra frame holds the arguments of a
+    // call that is about to fail the depth check. The top-level expression's
+    // let bindings come first.
+    size_t stack_size = p->local_count + (max_depth + 1) * max_frame_size;
+
+    env->stack = calloc(stack_size, sizeof(long));
+    if (env->stack == NULL) { die("calloc failure"); }
+
+    env->stack_end = env->stack + stack_size;
+    env->frame = env->stack;
+    env->top = env->stack + p->local_count;
+    env->depth = 0;
+    env->max_depth = max_depth;
+    env->calls = 0;
+    env->deepest = 0;
+    env->tiering = NULL;
+
+    set_native_stack_limit(env);
 }
 
-struct var_binding *create_var_binding(struct environment *env,
-                                       struct ident *ident, struct expr *expr) {
-    checked_calloc(struct var_binding, var_binding)
+void free_environment(struct environment *env) {
+    stats_count_calls(env->calls, env->deepest);
 
-    var_binding->var_name = ident;
-    var_binding->var_value = interpret_expr(env, expr);
+    free(env->stack);
+    env->stack = NULL;
+}
 
-    return var_binding;
+long lookup_var(struct environment *env, struct var v) {
+    return env->frame[v.slot];
 }
 
-long push_stack_frame(struct ident *func_ident,
-                               struct environment *env,
-                               struct param_entry *param_entry,
-                               struct arg_entry *arg_entry) {
-    struct var_binding *var_binding;
-    unsigned long arg_count = 0;
+void push_value(struct environment *env, long value) {
+    if (env->top == env->stack_end) {
+        die("Stack overflow: out of value stack space at call depth %lu", env->depth);
+    }
 
-    checked_calloc(struct stack_frame, stack_frame);
-    stack_frame->func_ident = func_ident;
+    *env->top++ = value;
+}
 
-    while (param_entry != NULL && arg_entry != NULL) {
-        var_binding = create_var_binding(env, param_entry->value, arg_entry->value);
-        set_next(var_binding, stack_frame->var_binding);
-        stack_frame->var_binding = var_binding;
+// Make room after the arguments in the current frame for the let bindings of
+// func, which is about to run in it.
+void reserve_locals(struct environment *env, struct func *func) {
+    long *locals = env->frame + func->param_count;
 
-        arg_entry = next_entry(arg_entry, struct arg_entry);
-        param_entry = next_entry(param_entry, struct param_entry);
-        arg_count++;
+    if (func->local_count > (unsigned long)(env->stack_end - locals)) {
+        die("Stack overflow: out of value stack space at call depth %lu", env->depth);
     }
 
-    set_next(stack_frame, env->stack_frame);
-    env->stack_frame = stack_frame;
+    env->top = locals + func->local_count;
+}
+
+native_func tiered_native_func(struct tiering *tiering, struct func *func) {
+    native_func native = tiering->native_funcs[func->index];
 
-    if (param_entry != NULL || arg_entry != NULL) {
-        die("Unexpected arg count for %s, expected %lu, got %lu args",
-            func_ident->name,
-            arg_count + linked_list_count((struct link *)param_entry),
-            arg_count + linked_list_count((struct link *)arg_entry));
+    if (native == NULL && ++tiering->call_counts[func->index] == tiering->threshold) {
+        native = tiering->compile(tiering->compiler, func);
+        tiering->native_funcs[func->index] = native;
     }
 
-    return arg_count;
+    return native;
 }
 
-void pop_stack_frame(struct environment *env, unsigned long arg_count) {
-    struct var_binding *binding;
-    struct stack_frame *stack_frame = env->stack_frame;
+// Push the arguments of c, returning the position of the first.
+long *push_args(struct environment *env, struct call c) {
+    long *args = env->top;
+    struct arg_entry *arg_entry = c.args;
+
+    // Any calls made while evaluating an argument use (and release) the stack
+    // above the arguments pushed so far.
+    while (arg_entry != NULL) {
+        push_value(env, interpret_expr(env, arg_entry->value));
+        arg_entry = next_entry(arg_entry, struct arg_entry);
+    }
 
-    for (unsigned long a = 0; a < arg_count; a++) {
-        binding = stack_frame->var_binding;
-        stack_frame->var_binding = next_entry(binding, struct var_binding);
+    return args;
+}
 
-        free(binding);
+// Evaluate the body of func, whose arguments are in the current frame. A call
+// in tail position (the body itself, or an arm of a conditional or body of a
+// let in tail position) replaces the frame's arguments with its own and carries on with
+// the callee's body, so that tail calls run in constant stack space. That is
+// not possible when either function is memoised, as the memo table needs the
+// arguments and result of each call. When profiling, a tail call leaves the
+// caller's profile before entering the callee's.
+long interpret_body(struct environment *env, struct func *func) {
+    struct func *current = func;
+    struct expr *expr = func->body;
+    long result;
+
+    if (func->profile != NULL) {
+        nickel_profile_enter(func->profile);
     }
 
-    env->stack_frame = next_entry(stack_frame, struct stack_frame);
+    while (true) {
+        if (expr->type == CONDITIONAL) {
+            struct conditional c = expr->conditional;
+            expr = interpret_expr(env, c.cond) ? c.on_true : c.on_false;
+        } else if (expr->type == LET) {
+            env->frame[expr->let.slot] = interpret_expr(env, expr->let.value);
+            expr = expr->let.body;
+        } else if (expr->type == CALL && func->memo == NULL && expr->call.func->memo == NULL) {
+            struct func *callee = expr->call.func;
+            long *args = push_args(env, expr->call);
+
+            env->calls++;
+
+            if (current->profile != NULL) {
+                nickel_profile_exit();
+            }
+
+            if (env->tiering != NULL) {
+                native_func native = tiered_native_func(env->tiering, callee);
+
+                if (native != NULL) {
+                    long func_res = native(args);
+                    env->top = args;
+
+                    return func_res;
+                }
+            }
+
+            if (callee->profile != NULL) {
+                nickel_profile_enter(callee->profile);
+            }
+
+            memmove(env->frame, args, callee->param_count * sizeof(long)); /* Flawfinder: ignore */
+            reserve_locals(env, callee);
+            current = callee;
+            expr = callee->body;
+        } else {
+            result = interpret_expr(env, expr);
+
+            if (current->profile != NULL) {
+                nickel_profile_exit();
+            }
+
+            return result;
+        }
+    }
 }
 
-long interpret_call(struct environment *env, struct call c) {
-    struct func *f;
+// Call func, whose arguments have been pushed from frame.
+long interpret_frame(struct environment *env, struct func *func, long *frame) {
+    long *caller_frame = env->frame;
     long func_res;
-    unsigned long arg_count;
 
-    f = lookup_func(env, c.callee);
+    env->calls++;
+
+    if (env->tiering != NULL) {
+        native_func native = tiered_native_func(env->tiering, func);
+
+        if (native != NULL) {
+            func_res = native(frame);
+            env->top = frame;
 
-    arg_count = push_stack_frame(f->ident, env, f->params, c.args);
+            return func_res;
+        }
+    }
+
+    // Native code does its own memoisation, so only interpreted calls look up
+    // the memo table here.
+    if (func->memo != NULL && nickel_memo_lookup(func->memo, frame, &func_res)) {
+        env->top = frame;
+
+        return func_res;
+    }
+
+    if (env->depth == env->max_depth) {
+        die("Stack overflow: call depth exceeds maximum of %lu", env->max_depth);
+    }
+
+    if ((char *)__builtin_frame_address(0) < env->native_stack_limit) {
+        die("Stack overflow: native stack exhausted at call depth %lu", env->depth);
+    }
+
+    env->frame = frame;
+    env->depth++;
+
+    if (env->depth > env->deepest) {
+        env->deepest = env->depth;
+    }
 
-    func_res = interpret_expr(env, f->body);
+    reserve_locals(env, func);
+    func_res = interpret_body(env, func);
 
-    pop_stack_frame(env, arg_count);
+    env->depth--;
+    env->frame = caller_frame;
+    env->top = frame;
+
+    if (func->memo != NULL) {
+        nickel_memo_store(func->memo, frame, func_res);
+    }
 
     return func_res;
 }
 
+long interpret_call(struct environment *env, struct call c) {
+    return interpret_frame(env, c.func, push_args(env, c));
+}
+
+long interpret_function(struct environment *env, struct func *func, const long *args) {
+    // A call that failed may have left the environment part-way through one.
+    env->frame = env->stack;
+    env->top = env->stack;
+    env->depth = 0;
+
+    set_native_stack_limit(env);
+
+    for (unsigned long i = 0; i < func->param_count; i++) {
+        push_value(env, args[i]);
+    }
+
+    return interpret_frame(env, func, env->stack);
+}
+
 long interpret_expr(struct environment *env, struct expr *expr) {
     switch (expr->type) {
         case LITERAL:
@@ -161,5 +327,7 @@ long interpret_expr(struct environment *env, struct expr *expr) {
             return interpret_puts(env, expr->puts);
         case CALL:
             return interpret_call(env, expr->call);
+        case LET:
+            return interpret_let(env, expr->let);
     }
 }
@@ -1,4 +1,5 @@
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,21 +9,90 @@
 #include <llvm-c/Core.h>
 #include <llvm-c/ExecutionEngine.h>
 #include <llvm-c/Target.h>
+#include <llvm-c/TargetMachine.h>
+#include <llvm-c/Error.h>
+#include <llvm-c/Support.h>
+#include <llvm-c/Transforms/PassBuilder.h>
 #include <llvm-c/Transforms/PassManagerBuilder.h>
 
 #include "jit.h"
+#include "memo.h"
+#include "musttail.h"
+#include "perf_map.h"
+#include "profile.h"
+#include "stats.h"
+#include "runtime.h"
+
+_Thread_local LLVMContextRef jit_thread_context;
+
+LLVMContextRef jit_context(void) {
+    if (jit_thread_context == NULL) {
+        jit_thread_context = LLVMContextCreate();
+    }
 
-void jit_declare_definition_entry(LLVMModuleRef mod, struct definition_entry *definition_entry) {
-    struct func *func = definition_entry->value;
-    unsigned long param_count = linked_list_count((struct link *)func->params);
+    return jit_thread_context;
+}
+
+void jit_dispose_context(void) {
+    if (jit_thread_context != NULL) {
+        LLVMContextDispose(jit_thread_context);
+        jit_thread_context = NULL;
+    }
+}
+
+LLVMTypeRef jit_int64_type(LLVMModuleRef mod) {
+    return LLVMInt64TypeInContext(LLVMGetModuleContext(mod));
+}
+
+LLVMTypeRef jit_function_type(LLVMModuleRef mod, unsigned long param_count) {
     LLVMTypeRef param_types[param_count];
     for(unsigned long i = 0; i < param_count; i++) {
-        param_types[i] = LLVMInt64Type();
+        param_types[i] = jit_int64_type(mod);
     }
 
-    LLVMTypeRef ret_type = LLVMFunctionType(LLVMInt64Type(), param_types, param_count, false);
+    return LLVMFunctionType(jit_int64_type(mod), param_types, param_count, false);
+}
+
+void jit_add_attribute(LLVMValueRef f, const char *name) {
+    LLVMContextRef context = LLVMGetTypeContext(LLVMTypeOf(f));
+    unsigned kind = LLVMGetEnumAttributeKindForName(name, strlen(name)); /* Flawfinder: ignore */
+
+    LLVMAddAttributeAtIndex(f, LLVMAttributeFunctionIndex, LLVMCreateEnumAttribute(context, kind, 0));
+}
+
+// Call a Nickel function, or a pointer to one, which uses the fast calling
+// convention.
+LLVMValueRef jit_build_call(LLVMBuilderRef builder, LLVMValueRef callee, LLVMValueRef *args,
+                            unsigned long arg_count, const char *name) {
+    LLVMValueRef call = LLVMBuildCall(builder, callee, args, arg_count, name);
+
+    LLVMSetInstructionCallConv(call, LLVMFastCallConv);
+
+    return call;
+}
+
+void jit_declare_definition_entry(LLVMModuleRef mod, struct definition_entry *definition_entry) {
+    struct func *func = definition_entry->value;
+    unsigned long param_count = func->param_count;
+
+    LLVMTypeRef ret_type = jit_function_type(mod, param_count);
     LLVMValueRef f = LLVMAddFunction(mod, func->ident->name, ret_type);
 
+    // Nickel functions are only ever called by Nickel code, which can use any
+    // convention it likes. Declaring what analyse_readnone found lets LLVM
+    // remove and hoist calls even of functions in other modules, as under
+    // --orc or --partitions.
+    LLVMSetFunctionCallConv(f, LLVMFastCallConv);
+    jit_add_attribute(f, "nounwind");
+
+    if (func->readnone) {
+        jit_add_attribute(f, "readnone");
+
+        if (func->terminates) {
+            jit_add_attribute(f, "willreturn");
+        }
+    }
+
     LLVMValueRef args[param_count];
     LLVMGetParams(f, args);
 
@@ -35,35 +105,163 @@ void jit_declare_definition_entry(LLVMModuleRef mod, struct definition_entry *de
     }
 }
 
+#define RUNTIME_SYMBOL(f) { #f, (void (*)(void))f }
+
+const struct jit_runtime_symbol jit_runtime_symbols[] = {
+    RUNTIME_SYMBOL(nickel_puts_i64),
+    RUNTIME_SYMBOL(nickel_memo_lookup),
+    RUNTIME_SYMBOL(nickel_memo_store),
+    RUNTIME_SYMBOL(nickel_profile_enter),
+    RUNTIME_SYMBOL(nickel_profile_exit),
+};
+
+const unsigned long jit_runtime_symbol_count = sizeof(jit_runtime_symbols) / sizeof(jit_runtime_symbols[0]);
+
+LLVMValueRef jit_runtime_function(LLVMModuleRef mod, const char *name, LLVMTypeRef type) {
+    LLVMValueRef f = LLVMGetNamedFunction(mod, name);
+
+    return f != NULL ? f : LLVMAddFunction(mod, name, type);
+}
+
+// Build f as a wrapper that returns the result from func's memo table when it
+// is there, and otherwise calls (and stores the result of) the function that
+// is returned, for the caller to define as func's body.
+LLVMValueRef jit_memo_wrapper(LLVMModuleRef mod, LLVMValueRef f, struct func *func) {
+    LLVMContextRef context = LLVMGetModuleContext(mod);
+    LLVMTypeRef int64_type = jit_int64_type(mod);
+    LLVMTypeRef int64_ptr_type = LLVMPointerType(int64_type, 0);
+    LLVMTypeRef table_type = LLVMPointerType(LLVMInt8TypeInContext(context), 0);
+    unsigned long param_count = func->param_count;
+
+    size_t name_len = strlen(func->ident->name); /* Flawfinder: ignore */
+    char uncached_name[name_len + sizeof("$uncached")];
+    snprintf(uncached_name, sizeof(uncached_name), "%s$uncached", func->ident->name);
+
+    LLVMValueRef uncached = LLVMAddFunction(mod, uncached_name, LLVMGlobalGetValueType(f));
+    LLVMSetLinkage(uncached, LLVMInternalLinkage);
+    LLVMSetFunctionCallConv(uncached, LLVMFastCallConv);
+    jit_add_attribute(uncached, "nounwind");
+
+    LLVMTypeRef lookup_params[] = { table_type, int64_ptr_type, int64_ptr_type };
+    LLVMValueRef lookup = jit_runtime_function(
+        mod, "nickel_memo_lookup", LLVMFunctionType(LLVMInt1TypeInContext(context), lookup_params, 3, false));
+    LLVMTypeRef store_params[] = { table_type, int64_ptr_type, int64_type };
+    LLVMValueRef store = jit_runtime_function(
+        mod, "nickel_memo_store", LLVMFunctionType(LLVMVoidTypeInContext(context), store_params, 3, false));
+
+    LLVMBuilderRef builder = LLVMCreateBuilderInContext(context);
+    LLVMPositionBuilderAtEnd(builder, LLVMAppendBasicBlockInContext(context, f, "entry"));
+    LLVMBasicBlockRef hit_block = LLVMAppendBasicBlockInContext(context, f, "hit");
+    LLVMBasicBlockRef miss_block = LLVMAppendBasicBlockInContext(context, f, "miss");
+
+    // The table lives for as long as the program runs.
+    LLVMValueRef table = LLVMConstIntToPtr(
+        LLVMConstInt(int64_type, (uintptr_t)func->memo, false), table_type);
+    LLVMValueRef args = LLVMBuildArrayAlloca(
+        builder, int64_type, LLVMConstInt(int64_type, param_count > 0 ? param_count : 1, false), "args");
+    LLVMValueRef result = LLVMBuildAlloca(builder, int64_type, "result");
+    LLVMValueRef params[param_count];
+
+    for (unsigned long i = 0; i < param_count; i++) {
+        LLVMValueRef index = LLVMConstInt(int64_type, i, false);
+        params[i] = LLVMGetParam(f, i);
+        LLVMBuildStore(builder, params[i], LLVMBuildGEP(builder, args, &index, 1, "arg_ptr"));
+    }
+
+    LLVMValueRef lookup_args[] = { table, args, result };
+    LLVMValueRef hit = LLVMBuildCall(builder, lookup, lookup_args, 3, "hit");
+    LLVMBuildCondBr(builder, hit, hit_block, miss_block);
+
+    LLVMPositionBuilderAtEnd(builder, hit_block);
+    LLVMBuildRet(builder, LLVMBuildLoad(builder, result, "cached"));
+
+    LLVMPositionBuilderAtEnd(builder, miss_block);
+    LLVMValueRef computed = jit_build_call(builder, uncached, params, param_count, "computed");
+    LLVMValueRef store_args[] = { table, args, computed };
+    LLVMBuildCall(builder, store, store_args, 3, "");
+    LLVMBuildRet(builder, computed);
+
+    LLVMDisposeBuilder(builder);
+
+    return uncached;
+}
+
+// Call nickel_profile_enter with func's profile record.
+void jit_profile_enter(LLVMModuleRef mod, LLVMBuilderRef builder, struct func *func) {
+    LLVMContextRef context = LLVMGetModuleContext(mod);
+    LLVMTypeRef record_type = LLVMPointerType(LLVMInt8TypeInContext(context), 0);
+    LLVMValueRef enter = jit_runtime_function(
+        mod, "nickel_profile_enter", LLVMFunctionType(LLVMVoidTypeInContext(context), &record_type, 1, false));
+
+    // The record lives for as long as the program runs.
+    LLVMValueRef record = LLVMConstIntToPtr(
+        LLVMConstInt(jit_int64_type(mod), (uintptr_t)func->profile, false), record_type);
+
+    LLVMBuildCall(builder, enter, &record, 1, "");
+}
+
+void jit_profile_exit(LLVMModuleRef mod, LLVMBuilderRef builder) {
+    LLVMContextRef context = LLVMGetModuleContext(mod);
+    LLVMValueRef exit_function = jit_runtime_function(
+        mod, "nickel_profile_exit", LLVMFunctionType(LLVMVoidTypeInContext(context), NULL, 0, false));
+
+    LLVMBuildCall(builder, exit_function, NULL, 0, "");
+}
+
 void jit_define_definition_entry(LLVMModuleRef mod, struct definition_entry *definition_entry) {
     struct func *func = definition_entry->value;
     LLVMValueRef f = LLVMGetNamedFunction(mod, func->ident->name);
 
-    LLVMBasicBlockRef entry = LLVMAppendBasicBlock(f, "entry");
+    if (func->memo != NULL) {
+        f = jit_memo_wrapper(mod, f, func);
+    }
+
+    LLVMContextRef context = LLVMGetModuleContext(mod);
+    LLVMBasicBlockRef entry = LLVMAppendBasicBlockInContext(context, f, "entry");
 
-    LLVMBuilderRef builder = LLVMCreateBuilder();
+    LLVMBuilderRef builder = LLVMCreateBuilderInContext(context);
     LLVMPositionBuilderAtEnd(builder, entry);
 
-    LLVMBuildRet(builder, jit_expr(mod, builder, f, func->body));
+    if (func->profile != NULL) {
+        jit_profile_enter(mod, builder, func);
+    }
+
+    jit_tail_expr(mod, builder, f, NULL, func->body, func->profile != NULL);
+    LLVMDisposeBuilder(builder);
 }
 
 LLVMValueRef jit_cmp(LLVMBuilderRef builder, LLVMValueRef left, LLVMValueRef right, LLVMIntPredicate op) {
     LLVMValueRef cmp = LLVMBuildICmp(builder, op, left, right, "cmp");
-    LLVMValueRef cmp_32 = LLVMBuildIntCast(builder, cmp, LLVMInt64Type(), "cmp_cast");
 
     // For compatability with the interpreter, return 0 for false, 1 for true.
-    LLVMValueRef one = LLVMConstInt(LLVMInt64Type(), 1, false);
-    return LLVMBuildAnd(builder, cmp_32, one, "&&");
+    return LLVMBuildZExt(builder, cmp, LLVMTypeOf(left), "cmp_ext");
 }
 
-
 LLVMValueRef jit_le(LLVMBuilderRef builder, LLVMValueRef left, LLVMValueRef right) {
     return jit_cmp(builder, left, right, LLVMIntSLE);
 }
 
-LLVMValueRef jit_binop(LLVMModuleRef mod, LLVMBuilderRef builder, LLVMValueRef func, struct binop b) {
-    LLVMValueRef left = jit_expr(mod, builder, func, b.l);
-    LLVMValueRef right = jit_expr(mod, builder, func, b.r);
+// Evaluate expr as the condition of a branch: an i1 that is true unless expr
+// is 0. A comparison is branched on directly, rather than widened and then
+// compared with 0.
+LLVMValueRef jit_condition(LLVMModuleRef mod, LLVMBuilderRef builder, LLVMValueRef func, struct jit_scope *scope,
+                           struct expr *expr) {
+    if (expr->type == BINOP && (expr->binop.type == EQ || expr->binop.type == LE)) {
+        LLVMValueRef left = jit_expr(mod, builder, func, scope, expr->binop.l);
+        LLVMValueRef right = jit_expr(mod, builder, func, scope, expr->binop.r);
+
+        return LLVMBuildICmp(builder, expr->binop.type == EQ ? LLVMIntEQ : LLVMIntSLE, left, right, "cmp");
+    }
+
+    LLVMValueRef zero = LLVMConstInt(jit_int64_type(mod), 0, false);
+
+    return LLVMBuildICmp(builder, LLVMIntNE, jit_expr(mod, builder, func, scope, expr), zero, "nz");
+}
+
+LLVMValueRef jit_binop(LLVMModuleRef mod, LLVMBuilderRef builder, LLVMValueRef func, struct jit_scope *scope,
+                       struct binop b) {
+    LLVMValueRef left = jit_expr(mod, builder, func, scope, b.l);
+    LLVMValueRef right = jit_expr(mod, builder, func, scope, b.r);
 
     switch (b.type) {
         case EQ:
@@ -81,113 +279,187 @@ LLVMValueRef jit_binop(LLVMModuleRef mod, LLVMBuilderRef builder, LLVMValueRef f
     }
 }
 
-LLVMValueRef jit_conditional(LLVMModuleRef mod, LLVMBuilderRef builder, LLVMValueRef func, struct conditional c) {
-    LLVMValueRef cond = jit_expr(mod, builder, func, c.cond);
+LLVMValueRef jit_conditional(LLVMModuleRef mod, LLVMBuilderRef builder, LLVMValueRef func, struct jit_scope *scope,
+                             struct conditional c) {
+    LLVMValueRef cond = jit_condition(mod, builder, func, scope, c.cond);
 
-    LLVMBasicBlockRef then_block = LLVMAppendBasicBlock(func, "then");
-    LLVMBasicBlockRef else_block = LLVMAppendBasicBlock(func, "else");
-    LLVMBasicBlockRef merge_block = LLVMAppendBasicBlock(func, "merge");
+    LLVMContextRef context = LLVMGetModuleContext(mod);
+    LLVMBasicBlockRef then_block = LLVMAppendBasicBlockInContext(context, func, "then");
+    LLVMBasicBlockRef else_block = LLVMAppendBasicBlockInContext(context, func, "else");
+    LLVMBasicBlockRef merge_block = LLVMAppendBasicBlockInContext(context, func, "merge");
 
-    LLVMValueRef zero = LLVMConstInt(LLVMInt64Type(), 0, false);
-    LLVMValueRef cmp = LLVMBuildICmp(builder, LLVMIntNE, cond, zero, "nz");
-    LLVMBuildCondBr(builder, cmp, then_block, else_block);
+    LLVMBuildCondBr(builder, cond, then_block, else_block);
 
     LLVMPositionBuilderAtEnd(builder, then_block);
-    LLVMValueRef then_expr = jit_expr(mod, builder, func, c.on_true);
+    LLVMValueRef then_expr = jit_expr(mod, builder, func, scope, c.on_true);
     LLVMBuildBr(builder, merge_block);
     LLVMBasicBlockRef after_then_block = LLVMGetInsertBlock(builder);
 
     LLVMPositionBuilderAtEnd(builder, else_block);
-    LLVMValueRef else_expr = jit_expr(mod, builder, func, c.on_false);
+    LLVMValueRef else_expr = jit_expr(mod, builder, func, scope, c.on_false);
     LLVMBuildBr(builder, merge_block);
     LLVMBasicBlockRef after_else_block = LLVMGetInsertBlock(builder);
 
     LLVMPositionBuilderAtEnd(builder, merge_block);
-    LLVMValueRef phi_node = LLVMBuildPhi(builder, LLVMInt64Type(), "conditional");
+    LLVMValueRef phi_node = LLVMBuildPhi(builder, jit_int64_type(mod), "conditional");
     LLVMAddIncoming(phi_node, &then_expr, &after_then_block, 1);
     LLVMAddIncoming(phi_node, &else_expr, &after_else_block, 1);
 
     return phi_node;
 }
 
-LLVMValueRef jit_puts(LLVMModuleRef mod, LLVMBuilderRef builder, LLVMValueRef func, struct puts p) {
-    LLVMValueRef result = jit_expr(mod, builder, func, p.body);
-    LLVMValueRef format = LLVMBuildGlobalStringPtr(builder, "%ld\n", "format");
+LLVMValueRef jit_puts(LLVMModuleRef mod, LLVMBuilderRef builder, LLVMValueRef func, struct jit_scope *scope,
+                      struct puts p) {
+    LLVMValueRef result = jit_expr(mod, builder, func, scope, p.body);
+    LLVMValueRef puts_function = LLVMGetNamedFunction(mod, "nickel_puts_i64");
 
-    LLVMValueRef printf_function = LLVMGetNamedFunction(mod, "printf");
-    LLVMValueRef printf_args[] = { format, result };
+    return LLVMBuildCall(builder, puts_function, &result, 1, "puts");
+}
+
+LLVMValueRef jit_var(LLVMValueRef func, struct jit_scope *scope, struct var var) {
+    for (; scope != NULL; scope = scope->outer) {
+        if (scope->slot == var.slot) {
+            return scope->value;
+        }
+    }
 
-    return LLVMBuildCall(builder, printf_function, printf_args, 2, "printf");
+    return LLVMGetParam(func, var.slot);
 }
 
-LLVMValueRef jit_var(LLVMValueRef func, struct ident *search_ident) {
-    size_t name_len;
-    unsigned param_count = LLVMCountParams(func);
-    LLVMValueRef args[param_count];
+// A let's value is evaluated once, into an SSA value that its body uses
+// directly.
+LLVMValueRef jit_let(LLVMModuleRef mod, LLVMBuilderRef builder, LLVMValueRef func, struct jit_scope *scope,
+                     struct let l) {
+    struct jit_scope inner = { l.slot, jit_expr(mod, builder, func, scope, l.value), scope };
 
-    LLVMGetParams(func, args);
+    return jit_expr(mod, builder, func, &inner, l.body);
+}
 
-    for(unsigned long i = 0; i < param_count; i++) {
-        LLVMValueRef arg = args[i];
-        const char *name = LLVMGetValueName2(arg, &name_len);
+// Evaluate the arguments of call into args. Arity has already been checked by
+// resolve_program.
+void jit_call_args(LLVMModuleRef mod, LLVMBuilderRef builder, LLVMValueRef func, struct jit_scope *scope,
+                   struct call call, LLVMValueRef *args) {
+    struct arg_entry *arg_entry = call.args;
 
-        if (strcmp(name, search_ident->name) == 0) {
-            return arg;
-        }
+    for (unsigned long i = 0; i < call.func->param_count; i++) {
+        args[i] = jit_expr(mod, builder, func, scope, arg_entry->value);
+        arg_entry = next_entry(arg_entry, struct arg_entry);
     }
-
-    const char *func_name = LLVMGetValueName2(func, &name_len);
-    die("Could not find var %s in stack frame of %s!", search_ident->name, func_name);
 }
 
-LLVMValueRef jit_call(LLVMModuleRef mod, LLVMBuilderRef builder, LLVMValueRef func, struct call call) {
-    LLVMValueRef f = LLVMGetNamedFunction(mod, call.callee->name);
-
-    if (!f) {
-        die("Could not find named function %s", call.callee->name);
+// The function that a call of callee calls: its definition in mod or, when
+// calls go through its slot, whichever definition the slot holds by then.
+LLVMValueRef jit_callee(LLVMModuleRef mod, LLVMBuilderRef builder, struct func *callee) {
+    if (callee->slot == NULL) {
+        return LLVMGetNamedFunction(mod, callee->ident->name);
     }
 
-    unsigned long arg_count = linked_list_count((struct link *)call.args);
-    unsigned param_count = LLVMCountParams(f);
+    LLVMTypeRef pointer_type = LLVMPointerType(jit_function_type(mod, callee->param_count), 0);
+    LLVMValueRef slot = LLVMConstIntToPtr(LLVMConstInt(jit_int64_type(mod), (uintptr_t)callee->slot, false),
+                                          LLVMPointerType(pointer_type, 0));
 
-    if (arg_count != param_count) {
-        die("Urk, bad arg count");
-    }
+    return LLVMBuildLoad(builder, slot, callee->ident->name);
+}
 
-    LLVMValueRef args[arg_count];
-    struct arg_entry *arg_entry = call.args;
+LLVMValueRef jit_call(LLVMModuleRef mod, LLVMBuilderRef builder, LLVMValueRef func, struct jit_scope *scope,
+                      struct call call) {
+    LLVMValueRef args[call.func->param_count];
 
-    for (unsigned int i = 0; i < arg_count; i++) {
-        args[i] = jit_expr(mod, builder, func, arg_entry->value);
-        arg_entry = next_entry(arg_entry, struct arg_entry);
-    }
+    jit_call_args(mod, builder, func, scope, call, args);
 
-    return LLVMBuildCall(builder, f, args, arg_count, call.callee->name);
+    LLVMValueRef f = jit_callee(mod, builder, call.func);
+
+    return jit_build_call(builder, f, args, call.func->param_count, call.callee->name);
 }
 
-LLVMValueRef jit_expr(LLVMModuleRef mod, LLVMBuilderRef builder, LLVMValueRef func, struct expr *expr) {
+LLVMValueRef jit_expr(LLVMModuleRef mod, LLVMBuilderRef builder, LLVMValueRef func, struct jit_scope *scope,
+                      struct expr *expr) {
     switch (expr->type) {
         case LITERAL:
-            return LLVMConstInt(LLVMInt64Type(), expr->literal, false);
+            return LLVMConstInt(jit_int64_type(mod), expr->literal, false);
         case VAR:
-            return jit_var(func, expr->var);
+            return jit_var(func, scope, expr->var);
         case BINOP:
-            return jit_binop(mod, builder, func, expr->binop);
+            return jit_binop(mod, builder, func, scope, expr->binop);
         case CONDITIONAL:
-            return jit_conditional(mod, builder, func, expr->conditional);
+            return jit_conditional(mod, builder, func, scope, expr->conditional);
         case PUTS:
-            return jit_puts(mod, builder, func, expr->puts);
+            return jit_puts(mod, builder, func, scope, expr->puts);
         case CALL:
-            return jit_call(mod, builder, func, expr->call);
+            return jit_call(mod, builder, func, scope, expr->call);
+        case LET:
+            return jit_let(mod, builder, func, scope, expr->let);
     }
 }
 
-void declare_printf(LLVMModuleRef mod) {
-    LLVMTypeRef printf_args_ty_list[] = { LLVMPointerType(LLVMInt8Type(), 0) };
-    LLVMTypeRef printf_ty =
-        LLVMFunctionType(LLVMInt64Type(), printf_args_ty_list, 0, true);
+// Build the return of expr, which is in tail position in func (as are the arms
+// of a conditional, and the body of a let, in tail position). Calls in tail
+// position are musttail calls, so that they run in constant stack space, when
+// the callee's prototype matches func's (as LLVM requires); otherwise they are
+// only marked as tail calls. If func is profiled, it leaves its profile before
+// returning, or before making a tail call.
+void jit_tail_expr(LLVMModuleRef mod, LLVMBuilderRef builder, LLVMValueRef func, struct jit_scope *scope,
+                   struct expr *expr, bool profiled) {
+    if (expr->type == CONDITIONAL) {
+        struct conditional c = expr->conditional;
+        LLVMValueRef cond = jit_condition(mod, builder, func, scope, c.cond);
+
+        LLVMContextRef context = LLVMGetModuleContext(mod);
+        LLVMBasicBlockRef then_block = LLVMAppendBasicBlockInContext(context, func, "then");
+        LLVMBasicBlockRef else_block = LLVMAppendBasicBlockInContext(context, func, "else");
+
+        LLVMBuildCondBr(builder, cond, then_block, else_block);
+
+        LLVMPositionBuilderAtEnd(builder, then_block);
+        jit_tail_expr(mod, builder, func, scope, c.on_true, profiled);
+
+        LLVMPositionBuilderAtEnd(builder, else_block);
+        jit_tail_expr(mod, builder, func, scope, c.on_false, profiled);
+    } else if (expr->type == LET) {
+        struct jit_scope inner = { expr->let.slot, jit_expr(mod, builder, func, scope, expr->let.value), scope };
+
+        jit_tail_expr(mod, builder, func, &inner, expr->let.body, profiled);
+    } else if (expr->type == CALL) {
+        struct func *callee = expr->call.func;
+        LLVMValueRef args[callee->param_count];
+
+        jit_call_args(mod, builder, func, scope, expr->call, args);
+
+        if (profiled) {
+            jit_profile_exit(mod, builder);
+        }
+
+        LLVMValueRef call = jit_build_call(builder, jit_callee(mod, builder, callee), args,
+                                           callee->param_count, expr->call.callee->name);
 
-    LLVMAddFunction(mod, "printf", printf_ty);
+        if (callee->param_count == LLVMCountParams(func)) {
+            jit_set_musttail(call);
+        } else {
+            LLVMSetTailCall(call, true);
+        }
+
+        LLVMBuildRet(builder, call);
+    } else {
+        LLVMValueRef result = jit_expr(mod, builder, func, scope, expr);
+
+        if (profiled) {
+            jit_profile_exit(mod, builder);
+        }
+
+        LLVMBuildRet(builder, result);
+    }
+}
+
+void declare_puts(LLVMModuleRef mod) {
+    LLVMTypeRef int64_type = jit_int64_type(mod);
+    LLVMValueRef puts_function = LLVMAddFunction(
+        mod, "nickel_puts_i64", LLVMFunctionType(int64_type, &int64_type, 1, false));
+
+    // Its output buffer is the only memory it touches, and no Nickel code
+    // can see that, so calls of it only need to stay in order.
+    jit_add_attribute(puts_function, "nounwind");
+    jit_add_attribute(puts_function, "willreturn");
+    jit_add_attribute(puts_function, "inaccessiblememonly");
 }
 
 void declare_functions(LLVMModuleRef mod, struct definition_entry *definition_entry) {
@@ -206,30 +478,167 @@ void define_functions(LLVMModuleRef mod, struct definition_entry *definition_ent
     }
 }
 
+// Build `long name(long *args)`, which unpacks an interpreter frame and calls
+// func.
+void jit_frame_entry(LLVMModuleRef mod, struct func *func, const char *name) {
+    LLVMContextRef context = LLVMGetModuleContext(mod);
+    LLVMTypeRef args_type = LLVMPointerType(jit_int64_type(mod), 0);
+    LLVMTypeRef entry_type = LLVMFunctionType(jit_int64_type(mod), &args_type, 1, false);
+    LLVMValueRef entry_func = LLVMAddFunction(mod, name, entry_type);
+    LLVMValueRef callee = LLVMGetNamedFunction(mod, func->ident->name);
+
+    LLVMBuilderRef builder = LLVMCreateBuilderInContext(context);
+    LLVMPositionBuilderAtEnd(builder, LLVMAppendBasicBlockInContext(context, entry_func, "entry"));
+
+    LLVMValueRef args_ptr = LLVMGetParam(entry_func, 0);
+    LLVMValueRef args[func->param_count];
+
+    for (unsigned long i = 0; i < func->param_count; i++) {
+        LLVMValueRef index = LLVMConstInt(jit_int64_type(mod), i, false);
+        LLVMValueRef arg_ptr = LLVMBuildGEP(builder, args_ptr, &index, 1, "arg_ptr");
+        args[i] = LLVMBuildLoad(builder, arg_ptr, "arg");
+    }
+
+    LLVMBuildRet(builder, jit_build_call(builder, callee, args, func->param_count, "result"));
+    LLVMDisposeBuilder(builder);
+}
+
+// Build `long name(long, ...)`, which calls func with the C calling
+// convention, for code outside of Nickel to call.
+void jit_native_entry(LLVMModuleRef mod, struct func *func, const char *name) {
+    LLVMContextRef context = LLVMGetModuleContext(mod);
+    LLVMValueRef entry_func = LLVMAddFunction(mod, name, jit_function_type(mod, func->param_count));
+    LLVMValueRef callee = LLVMGetNamedFunction(mod, func->ident->name);
+    LLVMValueRef args[func->param_count];
+
+    LLVMBuilderRef builder = LLVMCreateBuilderInContext(context);
+    LLVMPositionBuilderAtEnd(builder, LLVMAppendBasicBlockInContext(context, entry_func, "entry"));
+
+    LLVMGetParams(entry_func, args);
+
+    LLVMValueRef call = jit_build_call(builder, callee, args, func->param_count, "result");
+    LLVMSetTailCall(call, true);
+    LLVMBuildRet(builder, call);
+    LLVMDisposeBuilder(builder);
+}
+
 void jit_expr_into_anonymous_function(LLVMModuleRef mod, struct expr *expr) {
-    LLVMTypeRef ret_type = LLVMFunctionType(LLVMVoidType(), NULL, 0, false);
+    LLVMContextRef context = LLVMGetModuleContext(mod);
+    LLVMTypeRef ret_type = LLVMFunctionType(LLVMVoidTypeInContext(context), NULL, 0, false);
     LLVMValueRef anon_tl = LLVMAddFunction(mod, "__anon_tl", ret_type);
-    LLVMBasicBlockRef entry = LLVMAppendBasicBlock(anon_tl, "entry");
+    LLVMBasicBlockRef entry = LLVMAppendBasicBlockInContext(context, anon_tl, "entry");
 
-    LLVMBuilderRef builder = LLVMCreateBuilder();
+    LLVMBuilderRef builder = LLVMCreateBuilderInContext(context);
     LLVMPositionBuilderAtEnd(builder, entry);
 
-    jit_expr(mod, builder, anon_tl, expr);
+    jit_expr(mod, builder, anon_tl, NULL, expr);
 
     LLVMBuildRetVoid(builder);
     LLVMDisposeBuilder(builder);
 }
 
-void apply_optimisation_passes(LLVMModuleRef mod) {
+void describe_jit_options(const struct jit_options *options, char *buffer, size_t size) {
+    snprintf(buffer, size, "opt-level %u, size-level %u, inline-threshold %u, codegen-level %d, "
+                           "fast-isel %d, host-cpu %d, new-pm %d, unbuffered %d",
+             options->opt_level, options->size_level, options->inline_threshold, options->codegen_level,
+             options->fast_isel, options->host_cpu, options->new_pass_manager, options->unbuffered_output);
+}
+
+// The C API has no setter for the new pass manager's inliner threshold, but
+// it does respect the command-line option.
+void jit_set_inline_threshold(unsigned threshold) {
+    char inline_threshold[sizeof("-inline-threshold=4294967295")];
+    const char *args[] = { "nickel", inline_threshold };
+
+    snprintf(inline_threshold, sizeof(inline_threshold), "-inline-threshold=%u", threshold);
+    LLVMParseCommandLineOptions(2, args, NULL);
+}
+
+void apply_new_pm_passes(LLVMModuleRef mod, LLVMTargetMachineRef target_machine, const struct jit_options *options) {
+    static const char *size_pipelines[] = { NULL, "default<Os>", "default<Oz>" };
+    char pipeline[sizeof("default<O0>")];
+
+    if (options->size_level > 0) {
+        snprintf(pipeline, sizeof(pipeline), "%s", size_pipelines[options->size_level]);
+    } else {
+        snprintf(pipeline, sizeof(pipeline), "default<O%u>", options->opt_level);
+    }
+
+    LLVMPassBuilderOptionsRef pass_builder_options = LLVMCreatePassBuilderOptions();
+    LLVMErrorRef error = LLVMRunPasses(mod, pipeline, target_machine, pass_builder_options);
+
+    if (error != NULL) {
+        char *message = LLVMGetErrorMessage(error);
+        fprintf(error_stream(), "error running passes: %s\n", message);
+        LLVMDisposeErrorMessage(message);
+        fail();
+    }
+
+    LLVMDisposePassBuilderOptions(pass_builder_options);
+}
+
+void apply_legacy_pm_passes(LLVMModuleRef mod, LLVMTargetMachineRef target_machine,
+                            const struct jit_options *options) {
     LLVMPassManagerBuilderRef pass_manager_builder = LLVMPassManagerBuilderCreate();
-    LLVMPassManagerBuilderUseInlinerWithThreshold(pass_manager_builder, 225);
-    LLVMPassManagerBuilderSetOptLevel(pass_manager_builder, 3);
+    if (options->opt_level > 0) {
+        LLVMPassManagerBuilderUseInlinerWithThreshold(pass_manager_builder, options->inline_threshold);
+    }
+    LLVMPassManagerBuilderSetOptLevel(pass_manager_builder, options->opt_level);
+    LLVMPassManagerBuilderSetSizeLevel(pass_manager_builder, options->size_level);
     LLVMPassManagerRef pass_manager = LLVMCreatePassManager();
 
+    if (target_machine != NULL) {
+        LLVMAddAnalysisPasses(target_machine, pass_manager);
+    }
+
     LLVMPassManagerBuilderPopulateModulePassManager(pass_manager_builder, pass_manager);
     LLVMRunPassManager(pass_manager, mod);
 
     LLVMDisposePassManager(pass_manager);
+    LLVMPassManagerBuilderDispose(pass_manager_builder);
+}
+
+void apply_optimisation_passes(LLVMModuleRef mod, LLVMTargetMachineRef target_machine,
+                               const struct jit_options *options) {
+    enum phase previous = phase_switch(PHASE_OPTIMISE);
+
+    if (stats.enabled) {
+        stats.ir_instructions_before += count_ir_instructions(mod);
+    }
+
+    if (options->new_pass_manager) {
+        apply_new_pm_passes(mod, target_machine, options);
+    } else {
+        apply_legacy_pm_passes(mod, target_machine, options);
+    }
+
+    if (stats.enabled) {
+        stats.ir_instructions_after += count_ir_instructions(mod);
+    }
+
+    phase_switch(previous);
+}
+
+// MCJIT offers no way to choose the CPU it targets, but code generation
+// respects per-function target attributes.
+void target_host_cpu(LLVMModuleRef mod) {
+    LLVMContextRef context = LLVMGetModuleContext(mod);
+    char *cpu = LLVMGetHostCPUName();
+    char *features = LLVMGetHostCPUFeatures();
+    LLVMAttributeRef cpu_attribute = LLVMCreateStringAttribute(
+        context, "target-cpu", strlen("target-cpu"), cpu, strlen(cpu)); /* Flawfinder: ignore */
+    LLVMAttributeRef features_attribute = LLVMCreateStringAttribute(
+        context, "target-features", strlen("target-features"), features, strlen(features)); /* Flawfinder: ignore */
+
+    for (LLVMValueRef f = LLVMGetFirstFunction(mod); f != NULL; f = LLVMGetNextFunction(f)) {
+        if (LLVMCountBasicBlocks(f) > 0) {
+            LLVMAddAttributeAtIndex(f, LLVMAttributeFunctionIndex, cpu_attribute);
+            LLVMAddAttributeAtIndex(f, LLVMAttributeFunctionIndex, features_attribute);
+        }
+    }
+
+    LLVMDisposeMessage(features);
+    LLVMDisposeMessage(cpu);
 }
 
 void dump_bitcode(LLVMModuleRef mod, const char *filename) {
@@ -244,43 +653,211 @@ void dump_bitcode(LLVMModuleRef mod, const char *filename) {
     }
 }
 
-void jit(struct program *p) {
-    LLVMModuleRef mod = LLVMModuleCreateWithName("jit_module");
+void verify_module(LLVMModuleRef mod) {
+    enum phase previous = phase_switch(PHASE_VERIFY);
+    char *error = NULL;
+
+    LLVMVerifyModule(mod, LLVMAbortProcessAction, &error);
+    LLVMDisposeMessage(error);
+
+    phase_switch(previous);
+}
+
+LLVMExecutionEngineRef create_execution_engine(LLVMModuleRef mod, const struct jit_options *options) {
+    LLVMExecutionEngineRef engine;
+    struct LLVMMCJITCompilerOptions mcjit_options;
+    char *error = NULL;
+    LLVMLinkInMCJIT();
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmPrinter();
+
+    if (options->host_cpu) {
+        target_host_cpu(mod);
+    }
+
+    for (unsigned long i = 0; i < jit_runtime_symbol_count; i++) {
+        LLVMAddSymbol(jit_runtime_symbols[i].name, (void *)(uintptr_t)jit_runtime_symbols[i].address);
+    }
+
+    LLVMInitializeMCJITCompilerOptions(&mcjit_options, sizeof(mcjit_options));
+    mcjit_options.OptLevel = options->codegen_level;
+    mcjit_options.EnableFastISel = options->fast_isel;
+
+    if (stats.enabled) {
+        mcjit_options.MCJMM = create_counting_memory_manager();
+    }
+
+    if (LLVMCreateMCJITCompilerForModule(&engine, mod, &mcjit_options, sizeof(mcjit_options), &error) != 0) {
+        die("failed to create execution engine");
+    }
+    if (error) {
+        fprintf(error_stream(), "error: %s\n", error);
+        LLVMDisposeMessage(error);
+        fail();
+    }
+
+    if (options->perf_map) {
+        jit_register_event_listener(engine, perf_map_listener());
+    }
+
+    return engine;
+}
+
+// Build the whole of p into one (unoptimised) module, with its top-level
+// expression (if it has one) as __anon_tl.
+LLVMModuleRef jit_build_module(struct program *p) {
+    enum phase previous = phase_switch(PHASE_BUILD);
+    LLVMModuleRef mod = LLVMModuleCreateWithNameInContext("jit_module", jit_context());
 
-    declare_printf(mod);
+    declare_puts(mod);
     declare_functions(mod, p->funcs);
     define_functions(mod, p->funcs);
 
-    jit_expr_into_anonymous_function(mod, p->expr);
+    // Only what the caller adds (such as __anon_tl) is called from outside
+    // the module, so the optimisers can drop, specialise or entirely inline
+    // definitions.
+    for (LLVMValueRef f = LLVMGetFirstFunction(mod); f != NULL; f = LLVMGetNextFunction(f)) {
+        if (LLVMCountBasicBlocks(f) > 0) {
+            LLVMSetLinkage(f, LLVMInternalLinkage);
+        }
+    }
+
+    if (p->expr != NULL) {
+        jit_expr_into_anonymous_function(mod, p->expr);
+    }
+
+    phase_switch(previous);
 
+    return mod;
+}
+
+// Verify and optimise mod, dumping the bitcode before and after if requested.
+void jit_optimise_module(LLVMModuleRef mod, LLVMTargetMachineRef target_machine, const struct jit_options *options) {
     // Write out unoptimised bitcode to file
     dump_bitcode(mod, "unoptimised_module.bc");
 
-    char *error = NULL;
-    LLVMVerifyModule(mod, LLVMAbortProcessAction, &error);
-    LLVMDisposeMessage(error);
+    verify_module(mod);
 
-    apply_optimisation_passes(mod);
+    apply_optimisation_passes(mod, target_machine, options);
 
     // Write out optimised bitcode to file
     dump_bitcode(mod, "optimised_module.bc");
+}
+
+LLVMTargetMachineRef create_host_target_machine(const struct jit_options *options) {
+    LLVMTargetRef target;
+    char *error = NULL;
+    char *triple = LLVMGetDefaultTargetTriple();
 
-    LLVMExecutionEngineRef engine;
-    error = NULL;
-    LLVMLinkInMCJIT();
     LLVMInitializeNativeTarget();
     LLVMInitializeNativeAsmPrinter();
-    if (LLVMCreateExecutionEngineForModule(&engine, mod, &error) != 0) {
-        fprintf(stderr, "failed to create execution engine\n");
-        exit(1);
+
+    if (LLVMGetTargetFromTriple(triple, &target, &error) != 0) {
+        fprintf(error_stream(), "error: %s\n", error);
+        LLVMDisposeMessage(error);
+        fail();
     }
-    if (error) {
-        fprintf(stderr, "error: %s\n", error);
+
+    char *cpu = options->host_cpu ? LLVMGetHostCPUName() : NULL;
+    char *features = options->host_cpu ? LLVMGetHostCPUFeatures() : NULL;
+
+    // Position-independent, so that the object can be loaded anywhere.
+    LLVMTargetMachineRef target_machine = LLVMCreateTargetMachine(
+        target, triple, cpu ? cpu : "generic", features ? features : "",
+        options->codegen_level, LLVMRelocPIC, LLVMCodeModelDefault);
+
+    LLVMDisposeMessage(features);
+    LLVMDisposeMessage(cpu);
+    LLVMDisposeMessage(triple);
+
+    return target_machine;
+}
+
+// Add `int main(void)`, which runs __anon_tl.
+void jit_add_main(LLVMModuleRef mod, const struct jit_options *options) {
+    LLVMContextRef context = LLVMGetModuleContext(mod);
+    LLVMTypeRef int_type = LLVMInt32TypeInContext(context);
+    LLVMValueRef main_func = LLVMAddFunction(mod, "main", LLVMFunctionType(int_type, NULL, 0, false));
+    LLVMValueRef anon_tl = LLVMGetNamedFunction(mod, "__anon_tl");
+
+    LLVMBuilderRef builder = LLVMCreateBuilderInContext(context);
+    LLVMPositionBuilderAtEnd(builder, LLVMAppendBasicBlockInContext(context, main_func, "entry"));
+
+    if (options->unbuffered_output) {
+        LLVMTypeRef bool_type = LLVMInt1TypeInContext(context);
+        LLVMValueRef set_unbuffered = LLVMAddFunction(
+            mod, "nickel_set_unbuffered", LLVMFunctionType(LLVMVoidTypeInContext(context), &bool_type, 1, false));
+        LLVMValueRef unbuffered = LLVMConstInt(bool_type, 1, false);
+
+        // A C bool argument is zero-extended by the caller.
+        unsigned zeroext = LLVMGetEnumAttributeKindForName("zeroext", strlen("zeroext")); /* Flawfinder: ignore */
+        LLVMAddAttributeAtIndex(set_unbuffered, 1, LLVMCreateEnumAttribute(context, zeroext, 0));
+
+        LLVMBuildCall(builder, set_unbuffered, &unbuffered, 1, "");
+    }
+
+    LLVMBuildCall(builder, anon_tl, NULL, 0, "");
+    LLVMBuildRet(builder, LLVMConstInt(int_type, 0, false));
+    LLVMDisposeBuilder(builder);
+}
+
+void jit_set_target(LLVMModuleRef mod, LLVMTargetMachineRef target_machine) {
+    char *triple = LLVMGetTargetMachineTriple(target_machine);
+    LLVMSetTarget(mod, triple);
+    LLVMDisposeMessage(triple);
+
+    LLVMTargetDataRef data_layout = LLVMCreateTargetDataLayout(target_machine);
+    LLVMSetModuleDataLayout(mod, data_layout);
+    LLVMDisposeTargetData(data_layout);
+}
+
+LLVMMemoryBufferRef jit_emit_object(LLVMModuleRef mod, LLVMTargetMachineRef target_machine) {
+    enum phase previous = phase_switch(PHASE_CODEGEN);
+    LLVMMemoryBufferRef object;
+    char *error = NULL;
+
+    if (LLVMTargetMachineEmitToMemoryBuffer(target_machine, mod, LLVMObjectFile, &error, &object) != 0) {
+        fprintf(error_stream(), "error: %s\n", error);
         LLVMDisposeMessage(error);
-        exit(1);
+        fail();
+    }
+
+    phase_switch(previous);
+
+    return object;
+}
+
+LLVMMemoryBufferRef jit_compile_object(struct program *p, bool with_main, const struct jit_options *options) {
+    LLVMTargetMachineRef target_machine = create_host_target_machine(options);
+    LLVMModuleRef mod = jit_build_module(p);
+
+    if (with_main) {
+        jit_add_main(mod, options);
     }
 
+    jit_set_target(mod, target_machine);
+    jit_optimise_module(mod, target_machine, options);
+
+    LLVMMemoryBufferRef object = jit_emit_object(mod, target_machine);
+
+    LLVMDisposeModule(mod);
+    LLVMDisposeTargetMachine(target_machine);
+
+    return object;
+}
+
+void jit(struct program *p, const struct jit_options *options) {
+    LLVMModuleRef mod = jit_build_module(p);
+
+    jit_optimise_module(mod, NULL, options);
+
+    phase_switch(PHASE_CODEGEN);
+
+    LLVMExecutionEngineRef engine = create_execution_engine(mod, options);
+
     int (*func)(void) = (int (*)(void))LLVMGetFunctionAddress(engine, "__anon_tl");
+
+    phase_switch(PHASE_EXECUTE);
     func();
 
     LLVMDisposeExecutionEngine(engine);
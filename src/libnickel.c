@@ -0,0 +1,351 @@
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <llvm-c/Core.h>
+#include <llvm-c/Error.h>
+#include <llvm-c/LLJIT.h>
+#include <llvm-c/Target.h>
+
+#include "callgraph.h"
+#include "interpreter.h"
+#include "jit.h"
+#include "libnickel.h"
+#include "optimiser.h"
+#include "orc.h"
+#include "parser_helpers.h"
+#include "resolver.h"
+#include "runtime.h"
+
+_Static_assert(sizeof(int64_t) == sizeof(long), "Nickel's values are longs");
+
+// Where a thread's errors go while it is in the API, so that they can be
+// handed back to the caller rather than printed.
+struct nickel_errors {
+    FILE *stream;
+    char *text;
+    size_t length;
+    // How much of text has already been handed back.
+    size_t reported;
+};
+
+// Interpreted calls each need an environment of their own, which is kept for
+// later calls once they are done with it.
+struct nickel_environment {
+    struct link link;
+    struct environment env;
+    struct nickel_errors errors;
+};
+
+struct nickel_function {
+    struct nickel *nickel;
+    struct func *func;
+    void *native;
+    // Native code that takes its arguments as an array, as nickel_call does.
+    native_func entry;
+};
+
+struct nickel {
+    enum nickel_engine engine;
+    struct program *p;
+    unsigned long function_count;
+    struct nickel_function *functions;
+    LLVMOrcLLJITRef jit;
+    pthread_mutex_t lock;
+    struct nickel_environment *spare_environments;
+};
+
+pthread_once_t nickel_targets_once = PTHREAD_ONCE_INIT;
+pthread_once_t nickel_flush_key_once = PTHREAD_ONCE_INIT;
+pthread_key_t nickel_flush_key;
+_Thread_local bool nickel_flushes_at_thread_exit;
+
+// LLVM's targets are registered once, before any thread looks them up.
+void nickel_init_targets(void) {
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmPrinter();
+}
+
+void nickel_errors_init(struct nickel_errors *errors) {
+    errors->text = NULL;
+    errors->length = 0;
+    errors->reported = 0;
+    errors->stream = open_memstream(&errors->text, &errors->length);
+    if (errors->stream == NULL) { die("open_memstream failure"); }
+}
+
+void nickel_errors_free(struct nickel_errors *errors) {
+    fclose(errors->stream);
+    free(errors->text);
+}
+
+// Hand back to *error whatever has been reported since last time, without its
+// trailing newline.
+void nickel_errors_take(struct nickel_errors *errors, char **error) {
+    fflush(errors->stream);
+
+    size_t length = errors->length - errors->reported;
+
+    if (length > 0 && errors->text[errors->reported + length - 1] == '\n') {
+        length--;
+    }
+
+    if (error != NULL) {
+        *error = strndup(errors->text + errors->reported, length);
+    }
+
+    errors->reported = errors->length;
+}
+
+// Compile the functions of nickel, along with their entries, and link them
+// into an LLJIT.
+void nickel_jit(struct nickel *nickel) {
+    struct jit_options options = DEFAULT_JIT_OPTIONS;
+    LLVMOrcExecutorAddress address;
+
+    // The code only ever runs on the machine that compiles it.
+    options.host_cpu = true;
+
+    LLVMTargetMachineRef target_machine = create_host_target_machine(&options);
+    LLVMModuleRef mod = jit_build_module(nickel->p);
+
+    // The definitions themselves are internal to the module, and use Nickel's
+    // own calling convention, so each is given entries for callers outside.
+    for (unsigned long i = 0; i < nickel->function_count; i++) {
+        char entry_name[sizeof("__native$18446744073709551615")];
+
+        snprintf(entry_name, sizeof(entry_name), "__entry$%lu", i);
+        jit_frame_entry(mod, nickel->functions[i].func, entry_name);
+
+        snprintf(entry_name, sizeof(entry_name), "__native$%lu", i);
+        jit_native_entry(mod, nickel->functions[i].func, entry_name);
+    }
+
+    jit_set_target(mod, target_machine);
+    jit_optimise_module(mod, target_machine, &options);
+
+    LLVMMemoryBufferRef object = jit_emit_object(mod, target_machine);
+
+    LLVMDisposeModule(mod);
+    LLVMDisposeTargetMachine(target_machine);
+
+    nickel->jit = orc_create_jit(&options);
+    orc_check(LLVMOrcLLJITAddObjectFile(nickel->jit, LLVMOrcLLJITGetMainJITDylib(nickel->jit), object),
+              "failed to add object");
+
+    // Everything is looked up now, so that calls never wait on the LLJIT.
+    for (unsigned long i = 0; i < nickel->function_count; i++) {
+        struct nickel_function *function = &nickel->functions[i];
+        char entry_name[sizeof("__native$18446744073709551615")];
+
+        snprintf(entry_name, sizeof(entry_name), "__native$%lu", i);
+        orc_check(LLVMOrcLLJITLookup(nickel->jit, &address, entry_name), "failed to look up function");
+        function->native = (void *)(uintptr_t)address;
+
+        snprintf(entry_name, sizeof(entry_name), "__entry$%lu", i);
+        orc_check(LLVMOrcLLJITLookup(nickel->jit, &address, entry_name), "failed to look up entry");
+        function->entry = (native_func)(uintptr_t)address;
+    }
+}
+
+bool nickel_compile_program(struct nickel *nickel, const char *source, size_t length) {
+    struct optimiser_report report;
+    struct definition_entry *definition_entry;
+
+    nickel->p = parse_definitions(source, length);
+
+    if (nickel->p == NULL || !resolve_program(nickel->p)) {
+        return false;
+    }
+
+    optimise_program(nickel->p, &report);
+    analyse_purity(nickel->p);
+    analyse_readnone(nickel->p);
+
+    nickel->function_count = linked_list_count((struct link *)nickel->p->funcs);
+    nickel->functions = calloc(nickel->function_count, sizeof(struct nickel_function));
+    if (nickel->functions == NULL && nickel->function_count > 0) { die("calloc failure"); }
+
+    definition_entry = nickel->p->funcs;
+
+    for (unsigned long i = 0; i < nickel->function_count; i++) {
+        nickel->functions[i].nickel = nickel;
+        nickel->functions[i].func = definition_entry->value;
+        definition_entry = next_entry(definition_entry, struct definition_entry);
+    }
+
+    if (nickel->engine == NICKEL_JIT) {
+        nickel_jit(nickel);
+    }
+
+    return true;
+}
+
+struct nickel *nickel_compile(const char *source, size_t length, enum nickel_engine engine, char **error) {
+    struct nickel_errors errors;
+    jmp_buf fail_target;
+    jmp_buf *previous_fail_target = current_fail_target();
+    FILE *previous_error_stream = error_stream();
+
+    checked_calloc(struct nickel, nickel);
+    nickel->engine = engine;
+    pthread_mutex_init(&nickel->lock, NULL);
+
+    pthread_once(&nickel_targets_once, nickel_init_targets);
+
+    nickel_errors_init(&errors);
+    set_error_stream(errors.stream);
+    set_fail_target(&fail_target);
+
+    bool ok = setjmp(fail_target) == 0 && nickel_compile_program(nickel, source, length);
+
+    set_fail_target(previous_fail_target);
+    set_error_stream(previous_error_stream);
+
+    if (!ok) {
+        nickel_errors_take(&errors, error);
+        nickel_release(nickel);
+        nickel = NULL;
+    }
+
+    nickel_errors_free(&errors);
+
+    return nickel;
+}
+
+void nickel_release(struct nickel *nickel) {
+    struct nickel_environment *environment = nickel->spare_environments;
+
+    while (environment != NULL) {
+        struct nickel_environment *next = next_entry(environment, struct nickel_environment);
+
+        free_environment(&environment->env);
+        nickel_errors_free(&environment->errors);
+        free(environment);
+        environment = next;
+    }
+
+    // There is no one to report a failure to dispose of the LLJIT to, and
+    // nothing to be done about it, so it is ignored rather than exiting.
+    if (nickel->jit != NULL) {
+        LLVMConsumeError(LLVMOrcDisposeLLJIT(nickel->jit));
+    }
+
+    if (nickel->p != NULL) {
+        free_program(nickel->p);
+    }
+
+    pthread_mutex_destroy(&nickel->lock);
+    free(nickel->functions);
+    free(nickel);
+}
+
+const struct nickel_function *nickel_lookup(struct nickel *nickel, const char *name) {
+    for (unsigned long i = 0; i < nickel->function_count; i++) {
+        if (strcmp(nickel->functions[i].func->ident->name, name) == 0) {
+            return &nickel->functions[i];
+        }
+    }
+
+    return NULL;
+}
+
+unsigned long nickel_param_count(const struct nickel_function *function) {
+    return function->func->param_count;
+}
+
+void *nickel_native(const struct nickel_function *function) {
+    return function->native;
+}
+
+struct nickel_environment *nickel_take_environment(struct nickel *nickel) {
+    pthread_mutex_lock(&nickel->lock);
+
+    struct nickel_environment *environment = nickel->spare_environments;
+
+    if (environment != NULL) {
+        nickel->spare_environments = next_entry(environment, struct nickel_environment);
+    }
+
+    pthread_mutex_unlock(&nickel->lock);
+
+    if (environment == NULL) {
+        environment = malloc(sizeof(struct nickel_environment));
+        if (environment == NULL) { die("malloc failure"); }
+
+        init_environment(&environment->env, nickel->p, DEFAULT_MAX_DEPTH);
+        nickel_errors_init(&environment->errors);
+    }
+
+    return environment;
+}
+
+void nickel_give_environment(struct nickel *nickel, struct nickel_environment *environment) {
+    pthread_mutex_lock(&nickel->lock);
+    set_next(environment, nickel->spare_environments);
+    nickel->spare_environments = environment;
+    pthread_mutex_unlock(&nickel->lock);
+}
+
+bool nickel_interpret(struct nickel_environment *environment, const struct nickel_function *function,
+                      const int64_t *args, int64_t *result) {
+    *result = interpret_function(&environment->env, function->func, (const long *)args);
+
+    return true;
+}
+
+void nickel_flush_at_thread_exit(void *unused) {
+    (void)unused;
+    nickel_flush();
+}
+
+void nickel_create_flush_key(void) {
+    if (pthread_key_create(&nickel_flush_key, nickel_flush_at_thread_exit) != 0) {
+        die("pthread_key_create failure");
+    }
+}
+
+// Write out what the calling thread prints when it exits, as its buffer is
+// lost with it. (What the main thread prints is written out at exit anyway.)
+void nickel_flush_when_thread_exits(void) {
+    if (!nickel_flushes_at_thread_exit) {
+        pthread_once(&nickel_flush_key_once, nickel_create_flush_key);
+        pthread_setspecific(nickel_flush_key, &nickel_flush_key);
+        nickel_flushes_at_thread_exit = true;
+    }
+}
+
+bool nickel_call(const struct nickel_function *function, const int64_t *args, int64_t *result, char **error) {
+    nickel_flush_when_thread_exits();
+
+    // Native code cannot fail.
+    if (function->entry != NULL) {
+        *result = function->entry((long *)args);
+        return true;
+    }
+
+    struct nickel_environment *environment = nickel_take_environment(function->nickel);
+    FILE *previous_error_stream = error_stream();
+    jmp_buf *previous_fail_target = current_fail_target();
+    jmp_buf fail_target;
+
+    set_error_stream(environment->errors.stream);
+    set_fail_target(&fail_target);
+
+    bool ok = setjmp(fail_target) == 0 && nickel_interpret(environment, function, args, result);
+
+    set_fail_target(previous_fail_target);
+    set_error_stream(previous_error_stream);
+
+    if (!ok) {
+        nickel_errors_take(&environment->errors, error);
+    }
+
+    nickel_give_environment(function->nickel, environment);
+
+    return ok;
+}
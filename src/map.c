@@ -0,0 +1,229 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <llvm-c/Core.h>
+#include <llvm-c/LLJIT.h>
+
+#include "map.h"
+#include "orc.h"
+#include "runtime.h"
+#include "stats.h"
+
+#define MAP_DRIVER_NAME "__map"
+
+typedef void (*map_driver)(const long *args, long *results, unsigned long count);
+
+struct map_reader {
+    FILE *input;
+    char *line;
+    size_t line_capacity;
+    unsigned long line_number;
+};
+
+struct func *map_find_func(struct program *p, const char *name) {
+    struct definition_entry *definition_entry;
+
+    // As when resolving calls, the first definition wins.
+    for (definition_entry = p->funcs; definition_entry != NULL;
+         definition_entry = next_entry(definition_entry, struct definition_entry)) {
+        if (strcmp(definition_entry->value->ident->name, name) == 0) {
+            return definition_entry->value;
+        }
+    }
+
+    die("No function named %s to map", name);
+}
+
+// Add `void __map(i64 *args, i64 *results, i64 count)`, which calls func once
+// for each of count tuples of arguments, as a simple counted loop that the
+// loop vectoriser can work with.
+void map_add_driver(LLVMModuleRef mod, struct func *func) {
+    LLVMContextRef context = LLVMGetModuleContext(mod);
+    LLVMTypeRef int64_type = jit_int64_type(mod);
+    LLVMTypeRef int64_ptr_type = LLVMPointerType(int64_type, 0);
+    LLVMTypeRef param_types[] = { int64_ptr_type, int64_ptr_type, int64_type };
+    LLVMValueRef driver = LLVMAddFunction(
+        mod, MAP_DRIVER_NAME, LLVMFunctionType(LLVMVoidTypeInContext(context), param_types, 3, false));
+    LLVMValueRef args = LLVMGetParam(driver, 0);
+    LLVMValueRef results = LLVMGetParam(driver, 1);
+    LLVMValueRef count = LLVMGetParam(driver, 2);
+    unsigned long param_count = func->param_count;
+
+    // The buffers never overlap, so results can be stored in any order.
+    unsigned noalias = LLVMGetEnumAttributeKindForName("noalias", strlen("noalias")); /* Flawfinder: ignore */
+    LLVMAddAttributeAtIndex(driver, 1, LLVMCreateEnumAttribute(context, noalias, 0));
+    LLVMAddAttributeAtIndex(driver, 2, LLVMCreateEnumAttribute(context, noalias, 0));
+
+    LLVMBasicBlockRef entry = LLVMAppendBasicBlockInContext(context, driver, "entry");
+    LLVMBasicBlockRef loop = LLVMAppendBasicBlockInContext(context, driver, "loop");
+    LLVMBasicBlockRef done = LLVMAppendBasicBlockInContext(context, driver, "done");
+    LLVMBuilderRef builder = LLVMCreateBuilderInContext(context);
+    LLVMValueRef zero = LLVMConstInt(int64_type, 0, false);
+
+    LLVMPositionBuilderAtEnd(builder, entry);
+    LLVMBuildCondBr(builder, LLVMBuildICmp(builder, LLVMIntEQ, count, zero, "empty"), done, loop);
+
+    LLVMPositionBuilderAtEnd(builder, loop);
+    LLVMValueRef i = LLVMBuildPhi(builder, int64_type, "i");
+    LLVMValueRef base = LLVMBuildMul(builder, i, LLVMConstInt(int64_type, param_count, false), "base");
+    LLVMValueRef call_args[param_count];
+
+    for (unsigned long j = 0; j < param_count; j++) {
+        LLVMValueRef index = LLVMBuildAdd(builder, base, LLVMConstInt(int64_type, j, false), "index");
+        LLVMValueRef arg = LLVMBuildGEP(builder, args, &index, 1, "arg");
+        call_args[j] = LLVMBuildLoad(builder, arg, "");
+    }
+
+    LLVMValueRef callee = LLVMGetNamedFunction(mod, func->ident->name);
+    LLVMValueRef result = jit_build_call(builder, callee, call_args, param_count, "result");
+    LLVMBuildStore(builder, result, LLVMBuildGEP(builder, results, &i, 1, "result_ptr"));
+
+    LLVMValueRef next = LLVMBuildNUWAdd(builder, i, LLVMConstInt(int64_type, 1, false), "next");
+    LLVMBuildCondBr(builder, LLVMBuildICmp(builder, LLVMIntEQ, next, count, "finished"), done, loop);
+
+    LLVMValueRef incoming_values[] = { zero, next };
+    LLVMBasicBlockRef incoming_blocks[] = { entry, loop };
+    LLVMAddIncoming(i, incoming_values, incoming_blocks, 2);
+
+    LLVMPositionBuilderAtEnd(builder, done);
+    LLVMBuildRetVoid(builder);
+    LLVMDisposeBuilder(builder);
+}
+
+// Read up to MAP_CHUNK_CALLS lines of param_count arguments each into args,
+// returning how many were read. Blank lines are skipped.
+unsigned long map_read_text(struct map_reader *reader, long *args, unsigned long param_count) {
+    unsigned long calls = 0;
+
+    while (calls < MAP_CHUNK_CALLS && getline(&reader->line, &reader->line_capacity, reader->input) >= 0) {
+        char *position = reader->line;
+        unsigned long arg_count = 0;
+
+        reader->line_number++;
+
+        for (;;) {
+            position += strspn(position, " \t\r\n,");
+
+            if (*position == '\0') {
+                break;
+            }
+
+            char *end;
+            errno = 0;
+            long value = strtol(position, &end, 10);
+
+            if (errno == ERANGE) {
+                die("Argument out of range on line %lu of input", reader->line_number);
+            }
+
+            if (end == position || strchr(" \t\r\n,", *end) == NULL) {
+                die("Invalid argument on line %lu of input", reader->line_number);
+            }
+
+            if (arg_count == param_count) {
+                die("Too many arguments on line %lu of input (expected %lu)", reader->line_number, param_count);
+            }
+
+            args[calls * param_count + arg_count++] = value;
+            position = end;
+        }
+
+        if (arg_count > 0 && arg_count < param_count) {
+            die("Too few arguments on line %lu of input (expected %lu)", reader->line_number, param_count);
+        }
+
+        if (arg_count > 0) {
+            calls++;
+        }
+    }
+
+    if (ferror(reader->input)) {
+        die("Failed to read input");
+    }
+
+    return calls;
+}
+
+unsigned long map_read_binary(FILE *input, long *args, unsigned long param_count) {
+    size_t values = fread(args, sizeof(long), MAP_CHUNK_CALLS * param_count, input);
+
+    if (ferror(input)) {
+        die("Failed to read input");
+    }
+
+    if (values % param_count != 0) {
+        die("Input ends part-way through a tuple of %lu arguments", param_count);
+    }
+
+    return values / param_count;
+}
+
+map_driver map_compile(LLVMOrcLLJITRef jit, struct program *p, struct func *func,
+                       const struct jit_options *options) {
+    LLVMTargetMachineRef target_machine = create_host_target_machine(options);
+    LLVMModuleRef mod = jit_build_module(p);
+    LLVMOrcExecutorAddress address;
+
+    map_add_driver(mod, func);
+
+    // The optimisers need to know the target's vector registers to vectorise.
+    jit_set_target(mod, target_machine);
+    jit_optimise_module(mod, target_machine, options);
+
+    LLVMMemoryBufferRef object = jit_emit_object(mod, target_machine);
+
+    LLVMDisposeModule(mod);
+    LLVMDisposeTargetMachine(target_machine);
+
+    orc_check(LLVMOrcLLJITAddObjectFile(jit, LLVMOrcLLJITGetMainJITDylib(jit), object), "failed to add object");
+    orc_check(LLVMOrcLLJITLookup(jit, &address, MAP_DRIVER_NAME), "failed to look up " MAP_DRIVER_NAME);
+
+    return (map_driver)(uintptr_t)address;
+}
+
+void jit_map(struct program *p, const char *name, bool binary, FILE *input, FILE *output,
+             const struct jit_options *options) {
+    struct func *func = map_find_func(p, name);
+    unsigned long param_count = func->param_count;
+    struct map_reader reader = { input, NULL, 0, 0 };
+    unsigned long calls;
+
+    if (param_count == 0) {
+        die("Cannot map %s, which takes no arguments", name);
+    }
+
+    LLVMOrcLLJITRef jit = orc_create_jit(options);
+    map_driver driver = map_compile(jit, p, func, options);
+
+    long *args = malloc(MAP_CHUNK_CALLS * param_count * sizeof(long));
+    long *results = malloc(MAP_CHUNK_CALLS * sizeof(long));
+    if (args == NULL || results == NULL) { die("malloc failure"); }
+
+    phase_switch(PHASE_EXECUTE);
+
+    while ((calls = binary ? map_read_binary(input, args, param_count)
+                           : map_read_text(&reader, args, param_count)) > 0) {
+        driver(args, results, calls);
+
+        if (binary) {
+            fwrite(results, sizeof(long), calls, output);
+        } else {
+            for (unsigned long i = 0; i < calls; i++) {
+                fprintf(output, "%ld\n", results[i]);
+            }
+        }
+    }
+
+    // Anything that the function printed itself comes after its results.
+    fflush(output);
+    nickel_flush();
+
+    free(reader.line);
+    free(results);
+    free(args);
+
+    orc_check(LLVMOrcDisposeLLJIT(jit), "failed to dispose LLJIT");
+}
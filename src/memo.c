@@ -0,0 +1,172 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "callgraph.h"
+#include "memo.h"
+
+#define MEMO_ENTRY_HEADER 2
+
+unsigned long memo_entry_size(struct memo_table *table) {
+    return table->param_count + MEMO_ENTRY_HEADER;
+}
+
+struct memo_table *memo_create(unsigned long param_count, unsigned long capacity) {
+    checked_calloc(struct memo_table, table);
+    unsigned long rounded = 1;
+
+    while (rounded < capacity) {
+        rounded <<= 1;
+    }
+
+    table->param_count = param_count;
+    table->mask = rounded - 1;
+    table->entries = calloc(rounded * memo_entry_size(table), sizeof(long));
+    if (table->entries == NULL) { die("calloc failure"); }
+
+    return table;
+}
+
+// Whether expr, which is in tail position if tail is set, makes a call that is
+// not in tail position.
+bool makes_non_tail_call(struct expr *expr, bool tail) {
+    struct arg_entry *arg_entry;
+
+    switch (expr->type) {
+        case LITERAL:
+        case VAR:
+            return false;
+        case BINOP:
+            return makes_non_tail_call(expr->binop.l, false) || makes_non_tail_call(expr->binop.r, false);
+        case CONDITIONAL:
+            return makes_non_tail_call(expr->conditional.cond, false) ||
+                   makes_non_tail_call(expr->conditional.on_true, tail) ||
+                   makes_non_tail_call(expr->conditional.on_false, tail);
+        case PUTS:
+            return makes_non_tail_call(expr->puts.body, false);
+        case LET:
+            return makes_non_tail_call(expr->let.value, false) || makes_non_tail_call(expr->let.body, tail);
+        case CALL:
+            if (!tail) {
+                return true;
+            }
+
+            arg_entry = expr->call.args;
+
+            while (arg_entry != NULL) {
+                if (makes_non_tail_call(arg_entry->value, false)) {
+                    return true;
+                }
+                arg_entry = next_entry(arg_entry, struct arg_entry);
+            }
+
+            return false;
+    }
+}
+
+void memo_init(struct program *p, unsigned long capacity) {
+    struct definition_entry *definition_entry;
+
+    analyse_purity(p);
+
+    for (definition_entry = p->funcs; definition_entry != NULL;
+         definition_entry = next_entry(definition_entry, struct definition_entry)) {
+        struct func *func = definition_entry->value;
+
+        // A function that makes no calls is cheaper to run than to look up,
+        // and one that only makes tail calls runs in constant stack space,
+        // which the memo table's bookkeeping would prevent.
+        if (func->pure && makes_non_tail_call(func->body, true)) {
+            func->memo = memo_create(func->param_count, capacity);
+        }
+    }
+}
+
+void memo_free(struct program *p) {
+    struct definition_entry *definition_entry;
+
+    for (definition_entry = p->funcs; definition_entry != NULL;
+         definition_entry = next_entry(definition_entry, struct definition_entry)) {
+        struct func *func = definition_entry->value;
+
+        if (func->memo != NULL) {
+            free(func->memo->entries);
+            free(func->memo);
+            func->memo = NULL;
+        }
+    }
+}
+
+size_t memo_bytes(struct memo_table *table) {
+    return sizeof(struct memo_table) + (table->mask + 1) * memo_entry_size(table) * sizeof(long);
+}
+
+void memo_report(struct program *p, FILE *stream) {
+    struct definition_entry *definition_entry;
+    unsigned long hits = 0, misses = 0;
+    size_t bytes = 0;
+
+    for (definition_entry = p->funcs; definition_entry != NULL;
+         definition_entry = next_entry(definition_entry, struct definition_entry)) {
+        struct func *func = definition_entry->value;
+        struct memo_table *table = func->memo;
+
+        if (table == NULL) {
+            continue;
+        }
+
+        unsigned long lookups = table->hits + table->misses;
+
+        fprintf(stream, "memo %s: %lu hits, %lu misses (%.1f%% hit rate), %lu of %lu entries used, %zu bytes\n",
+                func->ident->name, table->hits, table->misses,
+                lookups ? 100.0 * (double)table->hits / (double)lookups : 0.0,
+                table->used, table->mask + 1, memo_bytes(table));
+
+        hits += table->hits;
+        misses += table->misses;
+        bytes += memo_bytes(table);
+    }
+
+    fprintf(stream, "memo total: %lu hits, %lu misses (%.1f%% hit rate), %zu bytes\n",
+            hits, misses, hits + misses ? 100.0 * (double)hits / (double)(hits + misses) : 0.0, bytes);
+}
+
+long *memo_entry(struct memo_table *table, const long *args) {
+    unsigned long hash = 14695981039346656037UL;
+
+    // Mix whole arguments, rather than hashing their bytes one at a time.
+    for (unsigned long i = 0; i < table->param_count; i++) {
+        hash = (hash ^ (unsigned long)args[i]) * 0x9e3779b97f4a7c15UL;
+        hash ^= hash >> 32;
+    }
+
+    return table->entries + (hash & table->mask) * memo_entry_size(table);
+}
+
+bool nickel_memo_lookup(struct memo_table *table, const long *args, long *result) {
+    long *entry = memo_entry(table, args);
+
+    if (entry[0] && memcmp(entry + MEMO_ENTRY_HEADER, args, table->param_count * sizeof(long)) == 0) {
+        table->hits++;
+        *result = entry[1];
+
+        return true;
+    }
+
+    table->misses++;
+
+    return false;
+}
+
+void nickel_memo_store(struct memo_table *table, const long *args, long result) {
+    long *entry = memo_entry(table, args);
+
+    if (!entry[0]) {
+        entry[0] = 1;
+        table->used++;
+    }
+
+    entry[1] = result;
+    memcpy(entry + MEMO_ENTRY_HEADER, args, table->param_count * sizeof(long)); /* Flawfinder: ignore */
+}
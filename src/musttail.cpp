@@ -0,0 +1,8 @@
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Value.h>
+
+#include "musttail.h"
+
+void jit_set_musttail(LLVMValueRef call) {
+    llvm::unwrap<llvm::CallInst>(call)->setTailCallKind(llvm::CallInst::TCK_MustTail);
+}
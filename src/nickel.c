@@ -1,39 +1,597 @@
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
-#include "y.tab.h"
+#include <llvm-c/ExecutionEngine.h>
+#include <llvm-c/Target.h>
+
+#include "aot.h"
+#include "batch.h"
+#include "callgraph.h"
 #include "interpreter.h"
 #include "jit.h"
+#include "map.h"
+#include "memo.h"
+#include "object_cache.h"
+#include "optimiser.h"
+#include "orc.h"
+#include "parser_helpers.h"
+#include "partition.h"
+#include "profile.h"
+#include "resolver.h"
+#include "runtime.h"
+#include "session.h"
+#include "snapshot.h"
+#include "source.h"
+#include "stats.h"
+#include "tiering.h"
+#include "vm.h"
 
-void interpret(struct program *p) {
-    struct environment env = { NULL, NULL };
+void interpret(struct program *p, unsigned long max_depth) {
+    struct environment env;
 
-    env.head_definition_entry = p->funcs;
+    init_environment(&env, p, max_depth);
 
+    phase_switch(PHASE_EXECUTE);
     interpret_expr(&env, p->expr);
+
+    free_environment(&env);
+}
+
+void run_vm(struct program *p, unsigned long max_depth) {
+    struct vm_program *vm_program = vm_compile(p);
+
+    phase_switch(PHASE_EXECUTE);
+    vm_run(vm_program, max_depth);
+
+    vm_free(vm_program);
+}
+
+// If arg is of the form "<name>=<value>", parse value into *value.
+bool parse_ulong_option(const char *arg, const char *name, unsigned long *value) {
+    size_t name_len = strlen(name); /* Flawfinder: ignore */
+
+    if (strncmp(arg, name, name_len) != 0 || arg[name_len] != '=') {
+        return false;
+    }
+
+    char *end;
+    *value = strtoul(arg + name_len + 1, &end, 10);
+
+    if (end == arg + name_len + 1 || *end != '\0') {
+        die("Invalid value for %s: %s", name, arg + name_len + 1);
+    }
+
+    return true;
+}
+
+// If arg is of the form "<name>=<value>", point *value at value.
+bool parse_string_option(const char *arg, const char *name, const char **value) {
+    size_t name_len = strlen(name); /* Flawfinder: ignore */
+
+    if (strncmp(arg, name, name_len) != 0 || arg[name_len] != '=') {
+        return false;
+    }
+
+    *value = arg + name_len + 1;
+
+    return true;
+}
+
+// Parse -O0 to -O3, -Os and -Oz into options.
+bool parse_opt_level(const char *arg, struct jit_options *options) {
+    if (strncmp(arg, "-O", 2) != 0 || arg[2] == '\0' || arg[3] != '\0') {
+        return false;
+    }
+
+    if (arg[2] >= '0' && arg[2] <= '3') {
+        options->opt_level = (unsigned)(arg[2] - '0');
+        options->size_level = 0;
+    } else if (arg[2] == 's' || arg[2] == 'z') {
+        options->opt_level = 2;
+        options->size_level = arg[2] == 's' ? 1 : 2;
+    } else {
+        die("Invalid optimisation level: %s", arg);
+    }
+
+    return true;
+}
+
+// Print --stats, including the time spent writing out buffered output.
+void report_stats(const char *format) {
+    nickel_flush();
+    stats_report(stderr, strcmp(format, "json") == 0);
+}
+
+void report_cache_stats(struct object_cache *cache, bool hit) {
+    unsigned long hits, misses;
+
+    object_cache_count(cache, hit, &hits, &misses);
+
+    fprintf(stderr, "object cache %s (%lu hits, %lu misses)\n", hit ? "hit" : "miss", hits, misses);
+}
+
+enum mode { INTERPRETER, JIT, ORC, VM, TIERED, EMIT_OBJ, EMIT_EXE };
+
+// Everything that the command line asks for, shared by every program of a
+// batch.
+struct settings {
+    enum mode mode;
+    unsigned long max_depth;
+    unsigned long tier_threshold;
+    const char *cache_dir;
+    bool cache_stats;
+    const char *output_path;
+    struct jit_options jit_options;
+    bool memoize;
+    unsigned long memo_capacity;
+    bool memo_stats;
+    bool profile;
+    bool optimise_ast;
+    bool optimiser_stats;
+    const char *stats_format;
+    bool batch;
+    unsigned long jobs;
+    unsigned long partitions;
+    bool session;
+    // The function to map over the inputs on stdin, if any.
+    const char *map;
+    bool map_binary;
+    // Where to write the program's snapshot (rather than running it), or to
+    // load the program from (rather than parsing it), if anywhere.
+    const char *compile_snapshot;
+    const char *load_snapshot;
+};
+
+// Parse and resolve source, then optimise its syntax tree. Returns NULL, having
+// reported why, if it is not a valid program.
+struct program *load_program(const struct settings *settings, struct source *source) {
+    // A program only has its functions mapped, so needs no top-level expression.
+    struct program *p = parse_in_place(source->text, source->length, settings->map == NULL);
+
+    if (p == NULL || !resolve_program(p)) {
+        if (p != NULL) {
+            free_program(p);
+        }
+
+        return NULL;
+    }
+
+    stats.parser_bytes = p->arena.allocated;
+
+    if (settings->optimise_ast) {
+        struct optimiser_report report;
+
+        phase_switch(PHASE_AST_OPTIMISE);
+        optimise_program(p, &report);
+
+        stats.ast_nodes_parsed = report.nodes_before;
+        stats.ast_nodes_optimised = report.nodes_after;
+
+        if (settings->optimiser_stats) {
+            fprintf(error_stream(), "AST optimiser removed %ld nodes (%lu before, %lu after)\n",
+                    (long)report.nodes_before - (long)report.nodes_after, report.nodes_before, report.nodes_after);
+        }
+    }
+
+    if (!settings->optimise_ast && stats.enabled) {
+        stats.ast_nodes_parsed = stats.ast_nodes_optimised = count_program_nodes(p);
+    }
+
+    phase_switch(PHASE_BUILD);
+
+    // The JIT declares what this (and analyse_readnone) finds to LLVM.
+    analyse_purity(p);
+
+    return p;
+}
+
+// Run p in the chosen mode, then free it.
+void run_program(const struct settings *settings, struct program *p) {
+    if (settings->memoize) {
+        memo_init(p, settings->memo_capacity);
+    }
+
+    if (settings->profile) {
+        profile_init(p);
+    }
+
+    analyse_readnone(p);
+
+    switch (settings->mode) {
+        case INTERPRETER:
+            interpret(p, settings->max_depth);
+            break;
+        case JIT:
+            if (settings->map != NULL) {
+                jit_map(p, settings->map, settings->map_binary, stdin, stdout, &settings->jit_options);
+            } else if (settings->partitions > 1) {
+                jit_partitioned(p, settings->partitions, &settings->jit_options);
+            } else {
+                jit(p, &settings->jit_options);
+            }
+            break;
+        case ORC:
+            orc(p, &settings->jit_options);
+            break;
+        case VM:
+            run_vm(p, settings->max_depth);
+            break;
+        case TIERED:
+            tiered(p, settings->max_depth, settings->tier_threshold, &settings->jit_options);
+            break;
+        case EMIT_OBJ:
+            emit_object(p, settings->output_path, &settings->jit_options);
+            break;
+        case EMIT_EXE:
+            emit_executable(p, settings->output_path, &settings->jit_options);
+            break;
+    }
+
+    if (settings->memoize) {
+        if (settings->memo_stats) {
+            memo_report(p, error_stream());
+        }
+
+        memo_free(p);
+    }
+
+    if (settings->profile) {
+        nickel_flush();
+        profile_report(p, stderr);
+        profile_free(p);
+    }
+
+    free_program(p);
+}
+
+// Run one program of a batch, on a worker thread.
+int run_batch_program(void *settings, struct source *source) {
+    struct program *p = load_program(settings, source);
+
+    if (p == NULL) {
+        return 1;
+    }
+
+    run_program(settings, p);
+    nickel_flush();
+
+    return 0;
+}
+
+// Run the program of a snapshot, which is already resolved and optimised.
+int run_snapshot(const struct settings *settings) {
+    struct snapshot snapshot;
+    struct program *p = snapshot_load(settings->load_snapshot, &snapshot);
+
+    if (p->expr == NULL && settings->map == NULL) {
+        die("%s has no top-level expression to run", settings->load_snapshot);
+    }
+
+    stats.source_bytes = snapshot.length;
+
+    phase_switch(PHASE_BUILD);
+
+    // A corrupt image could otherwise have a looping function declared
+    // willreturn, or one that prints memoised.
+    analyse_purity(p);
+    run_program(settings, p);
+    snapshot_free(&snapshot);
+
+    if (stats.enabled) {
+        report_stats(settings->stats_format);
+    }
+
+    return 0;
+}
+
+int run_batch(struct settings *settings, int argc, char *argv[]) {
+    struct batch batch;
+    bool from_stdin = true;
+
+    batch_init(&batch, run_batch_program, settings);
+
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            batch_add_file(&batch, argv[i]);
+            from_stdin = false;
+        }
+    }
+
+    if (from_stdin) {
+        batch_add_stream(&batch, stdin, "stdin");
+    }
+
+    // LLVM's targets are initialised once, before any worker needs them.
+    LLVMLinkInMCJIT();
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmPrinter();
+
+    unsigned long failures = batch_run(&batch, settings->jobs);
+
+    batch_free(&batch);
+
+    return failures > 0 ? 1 : 0;
 }
 
 int main(int argc, char *argv[]) {
-    bool use_jit = false;
+    struct settings settings = {
+        .mode = INTERPRETER,
+        .max_depth = DEFAULT_MAX_DEPTH,
+        .tier_threshold = DEFAULT_TIER_THRESHOLD,
+        .cache_dir = getenv("NICKEL_CACHE_DIR"), /* Flawfinder: ignore */
+        .jit_options = DEFAULT_JIT_OPTIONS,
+        .memo_capacity = DEFAULT_MEMO_CAPACITY,
+        .optimise_ast = true,
+        .partitions = 1,
+    };
+    struct jit_options *jit_options = &settings.jit_options;
+    unsigned long inline_threshold = jit_options->inline_threshold;
+    unsigned long codegen_level = jit_options->codegen_level;
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *map_format;
+
+    settings.jobs = processors > 0 ? (unsigned long)processors : 1;
+
     for (int i = 0; i < argc; i++) {
         if (strcmp(argv[i], "--jit") == 0) {
-            use_jit = true;
+            settings.mode = JIT;
+        } else if (strcmp(argv[i], "--orc") == 0) {
+            settings.mode = ORC;
+        } else if (strcmp(argv[i], "--vm") == 0) {
+            settings.mode = VM;
+        } else if (strcmp(argv[i], "--tiered") == 0) {
+            settings.mode = TIERED;
+        } else if (parse_ulong_option(argv[i], "--tier-threshold", &settings.tier_threshold) &&
+                   settings.tier_threshold == 0) {
+            die("--tier-threshold must be at least 1");
+        } else if (parse_ulong_option(argv[i], "--max-depth", &settings.max_depth) &&
+                   settings.max_depth == 0) {
+            die("--max-depth must be at least 1");
+        } else if (parse_string_option(argv[i], "--cache-dir", &settings.cache_dir)) {
+            continue;
+        } else if (strcmp(argv[i], "--cache-stats") == 0) {
+            settings.cache_stats = true;
+        } else if (parse_string_option(argv[i], "--emit-obj", &settings.output_path)) {
+            settings.mode = EMIT_OBJ;
+        } else if (parse_string_option(argv[i], "--emit-exe", &settings.output_path)) {
+            settings.mode = EMIT_EXE;
+        } else if (parse_opt_level(argv[i], jit_options)) {
+            continue;
+        } else if (parse_ulong_option(argv[i], "--inline-threshold", &inline_threshold) &&
+                   inline_threshold > UINT_MAX) {
+            die("--inline-threshold must be at most %u", UINT_MAX);
+        } else if (parse_ulong_option(argv[i], "--codegen-opt", &codegen_level) &&
+                   codegen_level > LLVMCodeGenLevelAggressive) {
+            die("--codegen-opt must be between 0 and 3");
+        } else if (strcmp(argv[i], "--fast-isel") == 0) {
+            jit_options->fast_isel = true;
+        } else if (strcmp(argv[i], "--host-cpu") == 0) {
+            jit_options->host_cpu = true;
+        } else if (strcmp(argv[i], "--new-pm") == 0) {
+            jit_options->new_pass_manager = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            settings.stats_format = "text";
+        } else if (parse_string_option(argv[i], "--stats", &settings.stats_format) &&
+                   strcmp(settings.stats_format, "text") != 0 && strcmp(settings.stats_format, "json") != 0) {
+            die("--stats must be text or json");
+        } else if (strcmp(argv[i], "--unbuffered") == 0) {
+            jit_options->unbuffered_output = true;
+        } else if (strcmp(argv[i], "--no-ast-opt") == 0) {
+            settings.optimise_ast = false;
+        } else if (strcmp(argv[i], "--ast-opt-stats") == 0) {
+            settings.optimiser_stats = true;
+        } else if (strcmp(argv[i], "--memoize") == 0) {
+            settings.memoize = true;
+        } else if (parse_ulong_option(argv[i], "--memo-capacity", &settings.memo_capacity) &&
+                   (settings.memo_capacity == 0 || settings.memo_capacity > (1UL << 32))) {
+            die("--memo-capacity must be between 1 and %lu", 1UL << 32);
+        } else if (strcmp(argv[i], "--memo-stats") == 0) {
+            settings.memo_stats = true;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            settings.profile = true;
+        } else if (strcmp(argv[i], "--perf-map") == 0) {
+            jit_options->perf_map = true;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            settings.batch = true;
+        } else if (parse_ulong_option(argv[i], "--jobs", &settings.jobs) && settings.jobs == 0) {
+            die("--jobs must be at least 1");
+        } else if (strcmp(argv[i], "--session") == 0) {
+            settings.session = true;
+        } else if (parse_ulong_option(argv[i], "--partitions", &settings.partitions) &&
+                   settings.partitions == 0) {
+            die("--partitions must be at least 1");
+        } else if (parse_string_option(argv[i], "--map", &settings.map) && settings.map[0] == '\0') {
+            die("--map needs a function name");
+        } else if (parse_string_option(argv[i], "--map-format", &map_format)) {
+            if (strcmp(map_format, "text") != 0 && strcmp(map_format, "binary") != 0) {
+                die("--map-format must be text or binary");
+            }
+
+            settings.map_binary = strcmp(map_format, "binary") == 0;
+        } else if (parse_string_option(argv[i], "--compile-snapshot", &settings.compile_snapshot)) {
+            continue;
+        } else if (parse_string_option(argv[i], "--load-snapshot", &settings.load_snapshot)) {
+            continue;
         }
     }
 
-    struct program *p;
+    // Memo tables live in this process, so their results cannot be compiled
+    // ahead of time (or cached), and the VM does not consult them.
+    if (settings.memoize && (settings.mode == VM || settings.mode == EMIT_OBJ || settings.mode == EMIT_EXE)) {
+        die("--memoize is only supported by the interpreter, --jit, --orc and --tiered");
+    }
 
-    int parse_result = yyparse(&p);
+    // Likewise for the profile's records.
+    if (settings.profile && (settings.mode == VM || settings.mode == EMIT_OBJ || settings.mode == EMIT_EXE)) {
+        die("--profile is only supported by the interpreter, --jit, --orc and --tiered");
+    }
 
-    if (parse_result == 0) {
-        if (use_jit) {
-            jit(p);
-        } else {
-            interpret(p);
+    if (settings.partitions > 1 && settings.mode != JIT) {
+        die("--partitions is only supported by --jit");
+    }
+
+    // A batch's programs run side by side, so their times cannot be told
+    // apart, and there is only one file to emit.
+    if (settings.batch && (settings.stats_format != NULL || settings.profile ||
+                           settings.mode == EMIT_OBJ || settings.mode == EMIT_EXE)) {
+        die("--batch does not support --stats, --profile, --emit-obj or --emit-exe");
+    }
+
+    // A session compiles each submission as it arrives, on its own.
+    if (settings.session && (settings.batch || settings.memoize || settings.profile || settings.partitions > 1 ||
+                             settings.mode == EMIT_OBJ || settings.mode == EMIT_EXE)) {
+        die("--session does not support --batch, --memoize, --profile, --partitions, --emit-obj or --emit-exe");
+    }
+
+    // A batch or session parses each of its programs as it comes.
+    if ((settings.compile_snapshot != NULL || settings.load_snapshot != NULL) &&
+        (settings.batch || settings.session || (settings.compile_snapshot != NULL && settings.load_snapshot != NULL))) {
+        die("--compile-snapshot and --load-snapshot do not support --batch, --session or each other");
+    }
+
+    // Mapping compiles the function with the JIT, and reads its inputs from
+    // stdin, so the program must be named.
+    if (settings.map != NULL) {
+        if ((settings.mode != INTERPRETER && settings.mode != JIT) || settings.batch || settings.session ||
+            settings.memoize || settings.profile || settings.partitions > 1) {
+            die("--map does not support --batch, --session, --memoize, --profile, --partitions or modes other "
+                "than --jit");
+        }
+
+        settings.mode = JIT;
+    }
+
+    jit_options->inline_threshold = (unsigned)inline_threshold;
+    jit_options->codegen_level = (LLVMCodeGenOptLevel)codegen_level;
+
+    jit_set_inline_threshold(jit_options->inline_threshold);
+    nickel_set_unbuffered(jit_options->unbuffered_output);
+
+    if (settings.batch) {
+        return run_batch(&settings, argc, argv);
+    }
+
+    stats.enabled = settings.stats_format != NULL;
+
+    if (settings.session) {
+        unsigned long failures = session(stdin, jit_options);
+
+        if (stats.enabled) {
+            report_stats(settings.stats_format);
         }
+
+        return failures > 0 ? 1 : 0;
+    }
+
+    phase_switch(PHASE_PARSE);
+
+    if (settings.load_snapshot != NULL) {
+        return run_snapshot(&settings);
+    }
+
+    struct source source;
+    const char *path = NULL;
+
+    // The program is read from the file named on the command line, if any, or
+    // otherwise from stdin.
+    for (int i = 1; i < argc && path == NULL; i++) {
+        if (argv[i][0] != '-') {
+            path = argv[i];
+        }
+    }
+
+    if (path == NULL && settings.map != NULL) {
+        die("--map needs the program to be named, as its inputs are read from stdin");
+    }
+
+    if (path != NULL) {
+        map_source(path, &source);
+    } else {
+        read_source(stdin, &source);
+    }
+    stats.source_bytes = source.length;
+
+    // Only the JIT caches compiled code; a hit skips straight to running it.
+    struct object_cache cache;
+    bool use_cache = settings.mode == JIT && settings.partitions == 1 && settings.map == NULL &&
+                     settings.compile_snapshot == NULL &&
+                     !settings.memoize && !settings.profile &&
+                     settings.cache_dir != NULL && settings.cache_dir[0] != '\0';
+
+    if (use_cache) {
+        object_cache_init(&cache, settings.cache_dir, &source, jit_options);
+
+        LLVMMemoryBufferRef object = object_cache_lookup(&cache);
+
+        if (object != NULL) {
+            free_source(&source);
+
+            if (settings.cache_stats) {
+                report_cache_stats(&cache, true);
+            }
+
+            phase_switch(PHASE_CODEGEN);
+            orc_run_object(object, jit_options);
+
+            object_cache_free(&cache);
+
+            if (stats.enabled) {
+                report_stats(settings.stats_format);
+            }
+
+            return 0;
+        }
+    }
+
+    struct program *p = load_program(&settings, &source);
+
+    free_source(&source);
+
+    if (p == NULL) {
+        if (use_cache) {
+            object_cache_free(&cache);
+        }
+
+        return 1;
+    }
+
+    if (settings.compile_snapshot != NULL) {
+        snapshot_write(p, settings.compile_snapshot);
+        free_program(p);
+
+        return 0;
+    }
+
+    if (use_cache) {
+        LLVMMemoryBufferRef object = jit_compile_object(p, false, jit_options);
+
+        object_cache_store(&cache, object);
+
+        if (settings.cache_stats) {
+            report_cache_stats(&cache, false);
+        }
+
+        orc_run_object(object, jit_options);
+
+        object_cache_free(&cache);
+        free_program(p);
+
+        if (stats.enabled) {
+            report_stats(settings.stats_format);
+        }
+
+        return 0;
+    }
+
+    run_program(&settings, p);
+
+    if (stats.enabled) {
+        report_stats(settings.stats_format);
     }
 
-    return parse_result;
+    return 0;
 }
@@ -0,0 +1,154 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <llvm-c/TargetMachine.h>
+#include <llvm/Config/llvm-config.h>
+
+#include "helpers.h"
+#include "jit.h"
+#include "object_cache.h"
+
+#define OBJECT_CACHE_MAGIC "NKLOBJ2\n"
+#define OBJECT_CACHE_MAGIC_LENGTH (sizeof(OBJECT_CACHE_MAGIC) - 1)
+
+char *object_cache_path(const char *dir, const char *name) {
+    size_t length = strlen(dir) + strlen(name) + 2; /* Flawfinder: ignore */
+    char *path = malloc(length);
+    if (path == NULL) { die("malloc failure"); }
+
+    snprintf(path, length, "%s/%s", dir, name);
+
+    return path;
+}
+
+void object_cache_init(struct object_cache *cache, const char *dir, struct source *source,
+                       const struct jit_options *options) {
+    char *cpu = LLVMGetHostCPUName();
+    char *features = LLVMGetHostCPUFeatures();
+    char name[sizeof("0123456789abcdef.o")];
+    char settings[256];
+
+    describe_jit_options(options, settings, sizeof(settings));
+
+    int settings_length = snprintf(NULL, 0, "llvm %s\ncpu %s\nfeatures %s\n%s\n",
+                                   LLVM_VERSION_STRING, cpu, features, settings);
+
+    cache->dir = dir;
+    cache->key_length = settings_length + source->length;
+    cache->key = malloc(cache->key_length + 1);
+    if (cache->key == NULL) { die("malloc failure"); }
+
+    snprintf(cache->key, settings_length + 1, "llvm %s\ncpu %s\nfeatures %s\n%s\n",
+             LLVM_VERSION_STRING, cpu, features, settings);
+    memcpy(cache->key + settings_length, source->text, source->length); /* Flawfinder: ignore */
+
+    snprintf(name, sizeof(name), "%016lx.o", hash_bytes(cache->key, cache->key_length));
+    cache->path = object_cache_path(dir, name);
+
+    LLVMDisposeMessage(features);
+    LLVMDisposeMessage(cpu);
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        die("Could not create cache directory %s: %s", dir, strerror(errno));
+    }
+}
+
+void object_cache_free(struct object_cache *cache) {
+    free(cache->path);
+    free(cache->key);
+}
+
+LLVMMemoryBufferRef object_cache_lookup(struct object_cache *cache) {
+    LLVMMemoryBufferRef entry;
+    LLVMMemoryBufferRef object = NULL;
+    char *error = NULL;
+
+    if (LLVMCreateMemoryBufferWithContentsOfFile(cache->path, &entry, &error) != 0) {
+        // Most likely the entry does not exist; either way, it is a miss.
+        LLVMDisposeMessage(error);
+        return NULL;
+    }
+
+    const char *data = LLVMGetBufferStart(entry);
+    size_t size = LLVMGetBufferSize(entry);
+    size_t header_length = OBJECT_CACHE_MAGIC_LENGTH + cache->key_length;
+
+    if (size > header_length &&
+        memcmp(data, OBJECT_CACHE_MAGIC, OBJECT_CACHE_MAGIC_LENGTH) == 0 &&
+        memcmp(data + OBJECT_CACHE_MAGIC_LENGTH, cache->key, cache->key_length) == 0) {
+        object = LLVMCreateMemoryBufferWithMemoryRangeCopy(
+            data + header_length, size - header_length, "cached_object");
+    }
+
+    LLVMDisposeMemoryBuffer(entry);
+
+    return object;
+}
+
+void object_cache_write(FILE *file, const void *data, size_t length) {
+    if (fwrite(data, 1, length, file) != length) {
+        die("Failed to write to object cache: %s", strerror(errno));
+    }
+}
+
+void object_cache_store(struct object_cache *cache, LLVMMemoryBufferRef object) {
+    size_t tmp_path_length = strlen(cache->path) + 32; /* Flawfinder: ignore */
+    char tmp_path[tmp_path_length];
+
+    // Write then rename, so that concurrent runs never see a partial entry.
+    snprintf(tmp_path, tmp_path_length, "%s.%ld.tmp", cache->path, (long)getpid());
+
+    FILE *file = fopen(tmp_path, "wb"); /* Flawfinder: ignore */
+    if (file == NULL) {
+        fprintf(stderr, "Could not write object cache entry %s: %s\n", tmp_path, strerror(errno));
+        return;
+    }
+
+    object_cache_write(file, OBJECT_CACHE_MAGIC, OBJECT_CACHE_MAGIC_LENGTH);
+    object_cache_write(file, cache->key, cache->key_length);
+    object_cache_write(file, LLVMGetBufferStart(object), LLVMGetBufferSize(object));
+
+    if (fclose(file) != 0 || rename(tmp_path, cache->path) != 0) {
+        fprintf(stderr, "Could not write object cache entry %s: %s\n", cache->path, strerror(errno));
+        unlink(tmp_path);
+    }
+}
+
+void object_cache_count(struct object_cache *cache, bool hit, unsigned long *hits, unsigned long *misses) {
+    char *path = object_cache_path(cache->dir, "stats");
+    int fd = open(path, O_RDWR | O_CREAT, 0644); /* Flawfinder: ignore */
+
+    *hits = *misses = 0;
+
+    if (fd < 0 || flock(fd, LOCK_EX) != 0) {
+        fprintf(stderr, "Could not update object cache stats %s: %s\n", path, strerror(errno));
+    } else {
+        FILE *file = fdopen(fd, "r+");
+        if (file == NULL) { die("fdopen failure"); }
+
+        if (fscanf(file, "hits %lu\nmisses %lu\n", hits, misses) != 2) {
+            *hits = *misses = 0;
+        }
+
+        *(hit ? hits : misses) += 1;
+
+        rewind(file);
+        fprintf(file, "hits %lu\nmisses %lu\n", *hits, *misses);
+
+        // Closing releases the lock.
+        fclose(file);
+        fd = -1;
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    free(path);
+}
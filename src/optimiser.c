@@ -0,0 +1,325 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "callgraph.h"
+#include "optimiser.h"
+#include "parser_helpers.h"
+
+struct optimiser {
+    struct arena *arena;
+    unsigned long func_count;
+    // Both indexed by function index.
+    bool *optimised;
+    bool *recursive;
+};
+
+unsigned long count_nodes(struct expr *expr) {
+    struct arg_entry *arg_entry;
+    unsigned long count = 1;
+
+    switch (expr->type) {
+        case LITERAL:
+        case VAR:
+            break;
+        case BINOP:
+            count += count_nodes(expr->binop.l) + count_nodes(expr->binop.r);
+            break;
+        case CONDITIONAL:
+            count += count_nodes(expr->conditional.cond) +
+                     count_nodes(expr->conditional.on_true) +
+                     count_nodes(expr->conditional.on_false);
+            break;
+        case PUTS:
+            count += count_nodes(expr->puts.body);
+            break;
+        case LET:
+            count += count_nodes(expr->let.value) + count_nodes(expr->let.body);
+            break;
+        case CALL:
+            arg_entry = expr->call.args;
+
+            while (arg_entry != NULL) {
+                count += count_nodes(arg_entry->value);
+                arg_entry = next_entry(arg_entry, struct arg_entry);
+            }
+            break;
+    }
+
+    return count;
+}
+
+unsigned long count_program_nodes(struct program *p) {
+    unsigned long count = p->expr != NULL ? count_nodes(p->expr) : 0;
+    struct definition_entry *definition_entry;
+
+    for (definition_entry = p->funcs; definition_entry != NULL;
+         definition_entry = next_entry(definition_entry, struct definition_entry)) {
+        count += count_nodes(definition_entry->value->body);
+    }
+
+    return count;
+}
+
+// Whether evaluating expr can have no side effect, and always terminates.
+bool is_simple(struct expr *expr) {
+    switch (expr->type) {
+        case LITERAL:
+        case VAR:
+            return true;
+        case BINOP:
+            return is_simple(expr->binop.l) && is_simple(expr->binop.r);
+        case CONDITIONAL:
+            return is_simple(expr->conditional.cond) &&
+                   is_simple(expr->conditional.on_true) &&
+                   is_simple(expr->conditional.on_false);
+        case LET:
+            return is_simple(expr->let.value) && is_simple(expr->let.body);
+        case PUTS:
+        case CALL:
+            return false;
+    }
+}
+
+unsigned long count_uses(struct expr *expr, unsigned long slot) {
+    struct arg_entry *arg_entry;
+    unsigned long count = 0;
+
+    switch (expr->type) {
+        case LITERAL:
+            break;
+        case VAR:
+            count = expr->var.slot == slot;
+            break;
+        case BINOP:
+            count = count_uses(expr->binop.l, slot) + count_uses(expr->binop.r, slot);
+            break;
+        case CONDITIONAL:
+            count = count_uses(expr->conditional.cond, slot) +
+                    count_uses(expr->conditional.on_true, slot) +
+                    count_uses(expr->conditional.on_false, slot);
+            break;
+        case PUTS:
+            count = count_uses(expr->puts.body, slot);
+            break;
+        case LET:
+            count = count_uses(expr->let.value, slot) + count_uses(expr->let.body, slot);
+            break;
+        case CALL:
+            arg_entry = expr->call.args;
+
+            while (arg_entry != NULL) {
+                count += count_uses(arg_entry->value, slot);
+                arg_entry = next_entry(arg_entry, struct arg_entry);
+            }
+            break;
+    }
+
+    return count;
+}
+
+// Copy expr, replacing each VAR with a copy of the argument in its slot (or
+// keeping it as it is, if args is NULL).
+struct expr *copy_expr(struct arena *arena, struct expr *expr, struct expr **args) {
+    struct expr *copy;
+    struct arg_entry *arg_entry;
+    struct arg_entry *last_arg_entry = NULL;
+
+    if (expr->type == VAR && args != NULL) {
+        return copy_expr(arena, args[expr->var.slot], NULL);
+    }
+
+    copy = arena_new(arena, struct expr);
+    *copy = *expr;
+
+    switch (expr->type) {
+        case LITERAL:
+        case VAR:
+            break;
+        case BINOP:
+            copy->binop.l = copy_expr(arena, expr->binop.l, args);
+            copy->binop.r = copy_expr(arena, expr->binop.r, args);
+            break;
+        case CONDITIONAL:
+            copy->conditional.cond = copy_expr(arena, expr->conditional.cond, args);
+            copy->conditional.on_true = copy_expr(arena, expr->conditional.on_true, args);
+            copy->conditional.on_false = copy_expr(arena, expr->conditional.on_false, args);
+            break;
+        case PUTS:
+            copy->puts.body = copy_expr(arena, expr->puts.body, args);
+            break;
+        case LET:
+            copy->let.value = copy_expr(arena, expr->let.value, args);
+            copy->let.body = copy_expr(arena, expr->let.body, args);
+            break;
+        case CALL:
+            arg_entry = expr->call.args;
+            copy->call.args = NULL;
+
+            while (arg_entry != NULL) {
+                struct arg_entry *copy_arg_entry = on_arg_entry(arena, copy_expr(arena, arg_entry->value, args), NULL);
+
+                if (last_arg_entry == NULL) {
+                    copy->call.args = copy_arg_entry;
+                } else {
+                    set_next(last_arg_entry, copy_arg_entry);
+                }
+
+                last_arg_entry = copy_arg_entry;
+                arg_entry = next_entry(arg_entry, struct arg_entry);
+            }
+            break;
+    }
+
+    return copy;
+}
+
+struct expr *optimise_expr(struct optimiser *optimiser, struct expr *expr);
+void optimise_func(struct optimiser *optimiser, struct func *func);
+
+struct expr *fold_binop(struct optimiser *optimiser, struct expr *expr) {
+    struct binop b = expr->binop;
+
+    if (b.l->type != LITERAL || b.r->type != LITERAL) {
+        return expr;
+    }
+
+    // Fold as the backends evaluate: with wrapping arithmetic on longs.
+    unsigned long l = b.l->literal, r = b.r->literal;
+
+    switch (b.type) {
+        case PLUS:
+            return on_literal(optimiser->arena, l + r);
+        case MINUS:
+            return on_literal(optimiser->arena, l - r);
+        case MULT:
+            return on_literal(optimiser->arena, l * r);
+        case LSHIFT:
+            // Shifts by 64 or more are undefined, so leave them alone.
+            return r < 64 ? on_literal(optimiser->arena, l << r) : expr;
+        case LE:
+            return on_literal(optimiser->arena, (long)l <= (long)r);
+        case EQ:
+            return on_literal(optimiser->arena, l == r);
+    }
+}
+
+// Inline a call of a small non-recursive function, when its arguments have no
+// side effects (so evaluating them at each use, rather than before the body,
+// is indistinguishable) and those that are used more than once are trivial.
+struct expr *inline_call(struct optimiser *optimiser, struct expr *expr) {
+    struct func *callee = expr->call.func;
+    struct expr *args[callee->param_count];
+    struct arg_entry *arg_entry = expr->call.args;
+
+    optimise_func(optimiser, callee);
+
+    // The slots of a callee's let bindings follow its own parameters, so would
+    // mean something else in the caller.
+    if (optimiser->recursive[callee->index] || callee->local_count > 0 ||
+        count_nodes(callee->body) > INLINE_MAX_NODES) {
+        return expr;
+    }
+
+    for (unsigned long i = 0; i < callee->param_count; i++) {
+        args[i] = arg_entry->value;
+        arg_entry = next_entry(arg_entry, struct arg_entry);
+
+        bool trivial = args[i]->type == LITERAL || args[i]->type == VAR;
+
+        if (!is_simple(args[i]) || (!trivial && count_uses(callee->body, i) > 1)) {
+            return expr;
+        }
+    }
+
+    return optimise_expr(optimiser, copy_expr(optimiser->arena, callee->body, args));
+}
+
+struct expr *optimise_expr(struct optimiser *optimiser, struct expr *expr) {
+    struct arg_entry *arg_entry;
+
+    switch (expr->type) {
+        case LITERAL:
+        case VAR:
+            return expr;
+        case BINOP:
+            expr->binop.l = optimise_expr(optimiser, expr->binop.l);
+            expr->binop.r = optimise_expr(optimiser, expr->binop.r);
+            return fold_binop(optimiser, expr);
+        case CONDITIONAL:
+            expr->conditional.cond = optimise_expr(optimiser, expr->conditional.cond);
+
+            if (expr->conditional.cond->type == LITERAL) {
+                return optimise_expr(optimiser, expr->conditional.cond->literal
+                                                    ? expr->conditional.on_true
+                                                    : expr->conditional.on_false);
+            }
+
+            expr->conditional.on_true = optimise_expr(optimiser, expr->conditional.on_true);
+            expr->conditional.on_false = optimise_expr(optimiser, expr->conditional.on_false);
+            return expr;
+        case PUTS:
+            expr->puts.body = optimise_expr(optimiser, expr->puts.body);
+            return expr;
+        case LET:
+            expr->let.value = optimise_expr(optimiser, expr->let.value);
+            expr->let.body = optimise_expr(optimiser, expr->let.body);
+            return expr;
+        case CALL:
+            arg_entry = expr->call.args;
+
+            while (arg_entry != NULL) {
+                arg_entry->value = optimise_expr(optimiser, arg_entry->value);
+                arg_entry = next_entry(arg_entry, struct arg_entry);
+            }
+
+            return inline_call(optimiser, expr);
+    }
+}
+
+// Functions are optimised before any function that calls them, so that only
+// the final size of a callee decides whether it is inlined.
+void optimise_func(struct optimiser *optimiser, struct func *func) {
+    if (optimiser->optimised[func->index]) {
+        return;
+    }
+
+    optimiser->optimised[func->index] = true;
+    func->body = optimise_expr(optimiser, func->body);
+}
+
+void optimise_program(struct program *p, struct optimiser_report *report) {
+    struct optimiser optimiser;
+    struct definition_entry *definition_entry;
+
+    report->nodes_before = count_program_nodes(p);
+
+    optimiser.arena = &p->arena;
+    optimiser.func_count = linked_list_count((struct link *)p->funcs);
+    optimiser.optimised = calloc(optimiser.func_count, sizeof(bool));
+    optimiser.recursive = calloc(optimiser.func_count, sizeof(bool));
+
+    if (optimiser.func_count > 0 && (optimiser.optimised == NULL || optimiser.recursive == NULL)) {
+        die("calloc failure");
+    }
+
+    struct call_graph graph;
+
+    call_graph_init(&graph, p);
+    find_recursive_funcs(&graph, optimiser.recursive);
+    call_graph_free(&graph);
+
+    for (definition_entry = p->funcs; definition_entry != NULL;
+         definition_entry = next_entry(definition_entry, struct definition_entry)) {
+        optimise_func(&optimiser, definition_entry->value);
+    }
+
+    if (p->expr != NULL) {
+        p->expr = optimise_expr(&optimiser, p->expr);
+    }
+
+    free(optimiser.recursive);
+    free(optimiser.optimised);
+
+    report->nodes_after = count_program_nodes(p);
+}
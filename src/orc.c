@@ -0,0 +1,279 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <llvm-c/Error.h>
+#include <llvm-c/LLJIT.h>
+#include <llvm-c/Orc.h>
+#include <llvm-c/OrcEE.h>
+
+#include "callgraph.h"
+#include "jit.h"
+#include "orc.h"
+#include "perf_map.h"
+#include "stats.h"
+
+// Each definition f is compiled into its own module, as the function f$body.
+// The symbol f itself is a lazy re-export of f$body: a stub that compiles and
+// links f's module the first time that it is called, so definitions that are
+// never called are never optimised or compiled.
+#define ORC_BODY_SUFFIX "$body"
+
+void orc_check(LLVMErrorRef error, const char *what) {
+    if (error != NULL) {
+        char *message = LLVMGetErrorMessage(error);
+        fprintf(error_stream(), "%s: %s\n", what, message); /* Flawfinder: ignore */
+        LLVMDisposeErrorMessage(message);
+        fail();
+    }
+}
+
+void orc_lazy_call_error(void) {
+    die("Failed to compile a lazily compiled function");
+}
+
+LLVMErrorRef orc_optimise_module(void *options, LLVMModuleRef mod) {
+    apply_optimisation_passes(mod, NULL, options);
+
+    return NULL;
+}
+
+// Modules are only optimised once they are about to be compiled.
+LLVMErrorRef orc_transform(void *options,
+                           LLVMOrcThreadSafeModuleRef *module_in_out,
+                           __attribute__((unused)) LLVMOrcMaterializationResponsibilityRef mr) {
+    return LLVMOrcThreadSafeModuleWithModuleDo(*module_in_out, orc_optimise_module, options);
+}
+
+void orc_optimise_on_compile(LLVMOrcLLJITRef jit, const struct jit_options *options) {
+    LLVMOrcIRTransformLayerSetTransform(LLVMOrcLLJITGetIRTransformLayer(jit), orc_transform, (void *)options);
+}
+
+LLVMErrorRef orc_count_code(__attribute__((unused)) void *ctx, LLVMMemoryBufferRef *object_in_out) {
+    stats.machine_code_bytes += count_code_bytes(*object_in_out);
+
+    return NULL;
+}
+
+void orc_declare_callee(struct call *call, void *mod_ptr) {
+    LLVMModuleRef mod = mod_ptr;
+    struct definition_entry definition_entry;
+
+    if (LLVMGetNamedFunction(mod, call->func->ident->name) == NULL) {
+        definition_entry.value = call->func;
+        jit_declare_definition_entry(mod, &definition_entry);
+    }
+}
+
+LLVMModuleRef orc_create_module(LLVMContextRef context, const char *name, struct expr *body) {
+    LLVMModuleRef mod = LLVMModuleCreateWithNameInContext(name, context);
+
+    declare_puts(mod);
+    visit_calls(body, orc_declare_callee, mod);
+
+    return mod;
+}
+
+void orc_add_module(LLVMOrcLLJITRef jit, LLVMOrcThreadSafeContextRef ts_context, LLVMModuleRef mod) {
+    verify_module(mod);
+
+    LLVMOrcThreadSafeModuleRef ts_module = LLVMOrcCreateNewThreadSafeModule(mod, ts_context);
+
+    orc_check(LLVMOrcLLJITAddLLVMIRModule(jit, LLVMOrcLLJITGetMainJITDylib(jit), ts_module),
+              "failed to add module");
+}
+
+void orc_add_definition(LLVMOrcLLJITRef jit, LLVMOrcThreadSafeContextRef ts_context, struct func *func) {
+    LLVMContextRef context = LLVMOrcThreadSafeContextGetContext(ts_context);
+    LLVMModuleRef mod = orc_create_module(context, func->ident->name, func->body);
+    struct definition_entry definition_entry = { { NULL }, func };
+
+    // The body may already have declared func, if it is recursive.
+    if (LLVMGetNamedFunction(mod, func->ident->name) == NULL) {
+        jit_declare_definition_entry(mod, &definition_entry);
+    }
+
+    jit_define_definition_entry(mod, &definition_entry);
+
+    // Recursive calls refer to the function itself, so bypass the stub.
+    size_t name_len = strlen(func->ident->name); /* Flawfinder: ignore */
+    char body_name[name_len + sizeof(ORC_BODY_SUFFIX)];
+    snprintf(body_name, sizeof(body_name), "%s" ORC_BODY_SUFFIX, func->ident->name);
+    LLVMSetValueName2(LLVMGetNamedFunction(mod, func->ident->name), body_name, strlen(body_name)); /* Flawfinder: ignore */
+
+    orc_add_module(jit, ts_context, mod);
+}
+
+void orc_add_lazy_reexports(LLVMOrcLLJITRef jit,
+                            LLVMOrcLazyCallThroughManagerRef lazy_call_through_manager,
+                            LLVMOrcIndirectStubsManagerRef indirect_stubs_manager,
+                            struct definition_entry *definition_entry) {
+    unsigned long func_count = linked_list_count((struct link *)definition_entry);
+    LLVMJITSymbolFlags flags = { LLVMJITSymbolGenericFlagsExported | LLVMJITSymbolGenericFlagsCallable, 0 };
+    LLVMOrcJITDylibRef dylib = LLVMOrcLLJITGetMainJITDylib(jit);
+
+    if (func_count == 0) {
+        return;
+    }
+
+    LLVMOrcCSymbolAliasMapPairs aliases = calloc(func_count, sizeof(LLVMOrcCSymbolAliasMapPair));
+    if (aliases == NULL) { die("calloc failure"); }
+
+    for (unsigned long i = 0; i < func_count; i++) {
+        const char *name = definition_entry->value->ident->name;
+        size_t name_len = strlen(name); /* Flawfinder: ignore */
+        char body_name[name_len + sizeof(ORC_BODY_SUFFIX)];
+        snprintf(body_name, sizeof(body_name), "%s" ORC_BODY_SUFFIX, name);
+
+        aliases[i].Name = LLVMOrcLLJITMangleAndIntern(jit, name);
+        aliases[i].Entry.Name = LLVMOrcLLJITMangleAndIntern(jit, body_name);
+        aliases[i].Entry.Flags = flags;
+
+        definition_entry = next_entry(definition_entry, struct definition_entry);
+    }
+
+    LLVMOrcMaterializationUnitRef reexports = LLVMOrcLazyReexports(
+        lazy_call_through_manager, indirect_stubs_manager, dylib, aliases, func_count);
+
+    orc_check(LLVMOrcJITDylibDefine(dylib, reexports), "failed to define lazy reexports");
+
+    free(aliases);
+}
+
+void orc_define_runtime_symbols(LLVMOrcLLJITRef jit) {
+    LLVMJITCSymbolMapPair symbols[jit_runtime_symbol_count];
+    LLVMJITSymbolFlags flags = { LLVMJITSymbolGenericFlagsExported | LLVMJITSymbolGenericFlagsCallable, 0 };
+
+    for (unsigned long i = 0; i < jit_runtime_symbol_count; i++) {
+        symbols[i].Name = LLVMOrcLLJITMangleAndIntern(jit, jit_runtime_symbols[i].name);
+        symbols[i].Sym.Address = (LLVMOrcExecutorAddress)(uintptr_t)jit_runtime_symbols[i].address;
+        symbols[i].Sym.Flags = flags;
+    }
+
+    orc_check(LLVMOrcJITDylibDefine(LLVMOrcLLJITGetMainJITDylib(jit),
+                                    LLVMOrcAbsoluteSymbols(symbols, jit_runtime_symbol_count)),
+              "failed to define runtime symbols");
+}
+
+// The same linking layer that LLJIT would otherwise create, but reporting the
+// symbols of the code that it loads to perf.
+LLVMOrcObjectLayerRef orc_create_perf_map_linking_layer(__attribute__((unused)) void *ctx,
+                                                        LLVMOrcExecutionSessionRef session,
+                                                        __attribute__((unused)) const char *triple) {
+    LLVMOrcObjectLayerRef layer = LLVMOrcCreateRTDyldObjectLinkingLayerWithSectionMemoryManager(session);
+
+    LLVMOrcRTDyldObjectLinkingLayerRegisterJITEventListener(layer, perf_map_listener());
+
+    return layer;
+}
+
+LLVMOrcLLJITRef orc_create_jit(const struct jit_options *options) {
+    LLVMOrcLLJITRef jit;
+    LLVMOrcDefinitionGeneratorRef process_symbols;
+
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmPrinter();
+
+    // The builder takes ownership of the target machine, and the LLJIT of the builder.
+    LLVMOrcLLJITBuilderRef builder = LLVMOrcCreateLLJITBuilder();
+    LLVMOrcLLJITBuilderSetJITTargetMachineBuilder(
+        builder, LLVMOrcJITTargetMachineBuilderCreateFromTargetMachine(create_host_target_machine(options)));
+
+    if (options->perf_map) {
+        LLVMOrcLLJITBuilderSetObjectLinkingLayerCreator(builder, orc_create_perf_map_linking_layer, NULL);
+    }
+
+    orc_check(LLVMOrcCreateLLJIT(&jit, builder), "failed to create LLJIT");
+
+    // Allow JIT'd code to call functions of this process, such as those that
+    // LLVM itself may emit calls of.
+    orc_check(LLVMOrcCreateDynamicLibrarySearchGeneratorForProcess(
+                  &process_symbols, LLVMOrcLLJITGetGlobalPrefix(jit), NULL, NULL),
+              "failed to create process symbol generator");
+    LLVMOrcJITDylibAddGenerator(LLVMOrcLLJITGetMainJITDylib(jit), process_symbols);
+
+    orc_define_runtime_symbols(jit);
+
+    if (stats.enabled) {
+        LLVMOrcObjectTransformLayerSetTransform(LLVMOrcLLJITGetObjTransformLayer(jit), orc_count_code, NULL);
+    }
+
+    return jit;
+}
+
+void orc_run_anonymous_function(LLVMOrcLLJITRef jit) {
+    LLVMOrcExecutorAddress address;
+
+    phase_switch(PHASE_CODEGEN);
+    orc_check(LLVMOrcLLJITLookup(jit, &address, "__anon_tl"), "failed to look up __anon_tl");
+
+    void (*func)(void) = (void (*)(void))address;
+
+    // Functions compiled lazily are compiled as part of this phase, although
+    // their optimisation is counted as optimisation.
+    phase_switch(PHASE_EXECUTE);
+    func();
+}
+
+void orc_run_objects(LLVMMemoryBufferRef *objects, unsigned long count, const struct jit_options *options) {
+    LLVMOrcLLJITRef jit = orc_create_jit(options);
+
+    for (unsigned long i = 0; i < count; i++) {
+        orc_check(LLVMOrcLLJITAddObjectFile(jit, LLVMOrcLLJITGetMainJITDylib(jit), objects[i]),
+                  "failed to add object");
+    }
+
+    orc_run_anonymous_function(jit);
+
+    orc_check(LLVMOrcDisposeLLJIT(jit), "failed to dispose LLJIT");
+}
+
+void orc_run_object(LLVMMemoryBufferRef object, const struct jit_options *options) {
+    orc_run_objects(&object, 1, options);
+}
+
+void orc(struct program *p, const struct jit_options *options) {
+    LLVMOrcLazyCallThroughManagerRef lazy_call_through_manager;
+    struct definition_entry *definition_entry;
+    LLVMOrcLLJITRef jit = orc_create_jit(options);
+
+    orc_optimise_on_compile(jit, options);
+
+    const char *triple = LLVMOrcLLJITGetTripleString(jit);
+    orc_check(LLVMOrcCreateLocalLazyCallThroughManager(
+                  triple, LLVMOrcLLJITGetExecutionSession(jit),
+                  (LLVMOrcJITTargetAddress)(uintptr_t)orc_lazy_call_error, &lazy_call_through_manager),
+              "failed to create lazy call-through manager");
+    LLVMOrcIndirectStubsManagerRef indirect_stubs_manager = LLVMOrcCreateLocalIndirectStubsManager(triple);
+
+    LLVMOrcThreadSafeContextRef ts_context = LLVMOrcCreateNewThreadSafeContext();
+
+    phase_switch(PHASE_BUILD);
+
+    definition_entry = p->funcs;
+
+    while (definition_entry != NULL) {
+        orc_add_definition(jit, ts_context, definition_entry->value);
+        definition_entry = next_entry(definition_entry, struct definition_entry);
+    }
+
+    orc_add_lazy_reexports(jit, lazy_call_through_manager, indirect_stubs_manager, p->funcs);
+
+    LLVMModuleRef mod = orc_create_module(
+        LLVMOrcThreadSafeContextGetContext(ts_context), "__anon_tl", p->expr);
+    jit_expr_into_anonymous_function(mod, p->expr);
+    orc_add_module(jit, ts_context, mod);
+
+    // The modules keep the context alive for as long as they need it.
+    LLVMOrcDisposeThreadSafeContext(ts_context);
+
+    orc_run_anonymous_function(jit);
+
+    // Tearing down the LLJIT first corrupts the heap once the stubs and
+    // trampolines span several pages, so dispose of them first.
+    LLVMOrcDisposeIndirectStubsManager(indirect_stubs_manager);
+    LLVMOrcDisposeLazyCallThroughManager(lazy_call_through_manager);
+    orc_check(LLVMOrcDisposeLLJIT(jit), "failed to dispose LLJIT");
+}
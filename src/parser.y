@@ -1,4 +1,5 @@
 %{
+#include <setjmp.h>
 #include <stdio.h>
 
 #include "parser_helpers.h"
@@ -21,20 +22,31 @@ void reverse_linked_list(struct link **head) {
 
 #define reverse(x) reverse_linked_list((struct link **)x)
 
-extern int yylex();
+%}
 
-int yywrap() {
-    return 1;
+%code requires {
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;
+#endif
 }
 
-void yyerror (__attribute__((unused)) struct program **_root_program, char const *s) {
-    fprintf (stderr, "%s\n", s);
+%code {
+int yylex(YYSTYPE *lvalp, yyscan_t scanner, struct symbol_table *symbols);
+
+void yyerror (__attribute__((unused)) yyscan_t _scanner,
+              __attribute__((unused)) struct arena *_arena,
+              __attribute__((unused)) struct symbol_table *_symbols,
+              __attribute__((unused)) struct program **_root_program,
+              char const *s) {
+    fprintf (error_stream(), "%s\n", s);
+}
 }
 
-%}
+%define api.pure full
 
-%token T_LPAREN T_RPAREN T_COMMA T_DEF T_END T_IF T_THEN T_ELSE
-%token <str> T_IDENT
+%token T_LPAREN T_RPAREN T_COMMA T_DEF T_END T_IF T_THEN T_ELSE T_LET T_ASSIGN T_IN
+%token <ident> T_IDENT
 %token <ulong> T_NUM
 %nonassoc T_PUTS T_LE T_EQ
 %left T_LSHIFT
@@ -42,7 +54,6 @@ void yyerror (__attribute__((unused)) struct program **_root_program, char const
 %left T_MULTIPLY
 
 %union {
-  char *str;
   struct expr *expr;
   unsigned long ulong;
   struct ident *ident;
@@ -61,59 +72,134 @@ void yyerror (__attribute__((unused)) struct program **_root_program, char const
 %type <param_entries> optional_params params;
 %type <definition_entries> definitions optional_definitions;
 
+%parse-param { yyscan_t scanner } { struct arena *arena } { struct symbol_table *symbols }
 %parse-param { struct program **root_program }
+%lex-param { yyscan_t scanner } { struct symbol_table *symbols }
 
 %start program
 
 %%
 
-program : optional_definitions expression { *root_program = on_program($1, $2); }
+program : optional_definitions expression { *root_program = on_program(arena, $1, $2); }
+        | definitions { reverse(&$1); *root_program = on_program(arena, $1, NULL); }
         ;
 
 optional_definitions : /* nothing */ { $$ = NULL; }
                      | definitions { reverse(&$1); $$ = $1; }
                      ;
 
-definitions : definitions definition { $$ = on_definition_entry($2, $1); }
-            | definition { $$ = on_definition_entry($1, NULL); }
+definitions : definitions definition { $$ = on_definition_entry(arena, $2, $1); }
+            | definition { $$ = on_definition_entry(arena, $1, NULL); }
             ;
 
-definition : T_DEF ident T_LPAREN optional_params T_RPAREN expression T_END { $$ = on_func_def($2, $4, $6); }
+definition : T_DEF ident T_LPAREN optional_params T_RPAREN expression T_END { $$ = on_func_def(arena, $2, $4, $6); }
            ;
 
-ident : T_IDENT { $$ = on_ident($1); }
+ident : T_IDENT { $$ = $1; }
       ;
 
 optional_params : /* nothing... */ { $$ = NULL; }
                 | params { reverse(&$1); $$ = $1; }
                 ;
 
-params : params T_COMMA ident { $$ = on_param_entry($3, $1); }
-       | ident { $$ = on_param_entry($1, NULL); }
+params : params T_COMMA ident { $$ = on_param_entry(arena, $3, $1); }
+       | ident { $$ = on_param_entry(arena, $1, NULL); }
        ;
 
-binop_expression : expression T_PLUS expression { $$ = on_binop(PLUS, $1, $3); }
-                 | expression T_LSHIFT expression { $$ = on_binop(LSHIFT, $1, $3); }
-                 | expression T_MULTIPLY expression { $$ = on_binop(MULT, $1, $3); }
-                 | expression T_MINUS expression { $$ = on_binop(MINUS, $1, $3); }
-                 | expression T_LE expression { $$ = on_binop(LE, $1, $3); }
-                 | expression T_EQ expression { $$ = on_binop(EQ, $1, $3); }
+binop_expression : expression T_PLUS expression { $$ = on_binop(arena, PLUS, $1, $3); }
+                 | expression T_LSHIFT expression { $$ = on_binop(arena, LSHIFT, $1, $3); }
+                 | expression T_MULTIPLY expression { $$ = on_binop(arena, MULT, $1, $3); }
+                 | expression T_MINUS expression { $$ = on_binop(arena, MINUS, $1, $3); }
+                 | expression T_LE expression { $$ = on_binop(arena, LE, $1, $3); }
+                 | expression T_EQ expression { $$ = on_binop(arena, EQ, $1, $3); }
                  ;
 
 optional_arguments : /* nothing... */ { $$ = NULL; }
                    | arguments { reverse(&$1); $$ = $1; }
                    ;
 
-arguments : arguments T_COMMA expression { $$ = on_arg_entry($3, $1); }
-          | expression { $$ = on_arg_entry($1, NULL); }
+arguments : arguments T_COMMA expression { $$ = on_arg_entry(arena, $3, $1); }
+          | expression { $$ = on_arg_entry(arena, $1, NULL); }
           ;
 
 expression : binop_expression { $$ = $1; }
-           | T_NUM { $$ = on_literal($1); }
-           | ident { $$ = on_var($1); }
-           | ident T_LPAREN optional_arguments T_RPAREN { $$ = on_func_call($1, $3); }
+           | T_NUM { $$ = on_literal(arena, $1); }
+           | ident { $$ = on_var(arena, $1); }
+           | ident T_LPAREN optional_arguments T_RPAREN { $$ = on_func_call(arena, $1, $3); }
            | T_LPAREN expression T_RPAREN { $$ = $2; }
-           | T_PUTS expression { $$ = on_puts($2); }
-           | T_IF expression T_THEN expression T_ELSE expression T_END { $$ = on_conditional($2, $4, $6); }
+           | T_PUTS expression { $$ = on_puts(arena, $2); }
+           | T_IF expression T_THEN expression T_ELSE expression T_END { $$ = on_conditional(arena, $2, $4, $6); }
+           | T_LET ident T_ASSIGN expression T_IN expression T_END { $$ = on_let(arena, $2, $4, $6); }
            ;
 %%
+
+// Parse the program that scanner scans, then destroy the scanner. Errors that
+// fail part-way through (such as a literal too large to parse) are caught
+// here, so that the scanner is destroyed and the caller can free the rest,
+// and are returned as NULL like any other error.
+static struct program *parse_scanned(yyscan_t scanner, struct arena *arena, struct symbol_table *symbols) {
+    struct program *p = NULL;
+    volatile int parse_result = 1;
+    jmp_buf *previous_fail_target = current_fail_target();
+    jmp_buf fail_target;
+
+    set_fail_target(&fail_target);
+
+    if (setjmp(fail_target) == 0) {
+        parse_result = yyparse(scanner, arena, symbols, &p);
+    }
+
+    set_fail_target(previous_fail_target);
+    lex_destroy(scanner);
+
+    return parse_result == 0 ? p : NULL;
+}
+
+struct program *parse_submission(const char *source, size_t length, struct arena *arena,
+                                 struct symbol_table *symbols) {
+    return parse_scanned(lex_create(source, length), arena, symbols);
+}
+
+static struct program *parse_owned_program(yyscan_t scanner, bool needs_expr) {
+    struct arena arena = { NULL, 0 };
+    struct symbol_table symbols;
+
+    symbol_table_init(&symbols, &arena);
+
+    struct program *p = parse_scanned(scanner, &arena, &symbols);
+
+    symbol_table_free(&symbols);
+
+    if (p != NULL && p->expr == NULL && needs_expr) {
+        yyerror(NULL, &arena, &symbols, &p, "syntax error");
+        p = NULL;
+    }
+
+    if (p == NULL) {
+        arena_free(&arena);
+        return NULL;
+    }
+
+    // The program is itself allocated in the arena that it takes ownership of.
+    p->arena = arena;
+
+    return p;
+}
+
+struct program *parse_program(const char *source, size_t length) {
+    return parse_owned_program(lex_create(source, length), true);
+}
+
+struct program *parse_definitions(const char *source, size_t length) {
+    return parse_owned_program(lex_create(source, length), false);
+}
+
+struct program *parse_in_place(char *source, size_t length, bool needs_expr) {
+    return parse_owned_program(lex_create_in_place(source, length), needs_expr);
+}
+
+void free_program(struct program *p) {
+    struct arena arena = p->arena;
+
+    arena_free(&arena);
+}
@@ -1,3 +1,4 @@
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -5,8 +6,8 @@
 #include "parser_helpers.h"
 
 #define declare_on_link_entry(struct_type_name, value_type) \
-struct struct_type_name *on_##struct_type_name(value_type *value, struct struct_type_name *next) { \
-    checked_calloc(struct struct_type_name, list_entry); \
+struct struct_type_name *on_##struct_type_name(struct arena *arena, value_type *value, struct struct_type_name *next) { \
+    struct struct_type_name *list_entry = arena_new(arena, struct struct_type_name); \
     list_entry->value = value; \
     set_next(list_entry, next); \
     return list_entry; \
@@ -16,14 +17,23 @@ declare_on_link_entry(arg_entry, struct expr)
 declare_on_link_entry(param_entry, struct ident)
 declare_on_link_entry(definition_entry, struct func)
 
-struct ident *on_ident(char *name) {
-    checked_calloc(struct ident, ident);
-    ident->name = name;
+unsigned long parse_literal(const char *text, size_t length) {
+    unsigned long value = 0;
 
-    return ident;
+    for (size_t i = 0; i < length; i++) {
+        unsigned long digit = (unsigned long)(text[i] - '0');
+
+        if (value > (ULONG_MAX - digit) / 10) {
+            die("Integer literal %.*s is too large", (int)length, text);
+        }
+
+        value = value * 10 + digit;
+    }
+
+    return value;
 }
 
-struct expr *on_literal(unsigned long value) {
+struct expr *on_literal(struct arena *arena, unsigned long value) {
     declare_expr_of_type(LITERAL);
 
     expr->literal = value;
@@ -31,7 +41,7 @@ struct expr *on_literal(unsigned long value) {
     return expr;
 }
 
-struct expr *on_binop(enum binop_type type, struct expr *l, struct expr *r) {
+struct expr *on_binop(struct arena *arena, enum binop_type type, struct expr *l, struct expr *r) {
     declare_expr_of_type(BINOP);
 
     expr->binop.type = type;
@@ -41,7 +51,7 @@ struct expr *on_binop(enum binop_type type, struct expr *l, struct expr *r) {
     return expr;
 }
 
-struct expr *on_puts(struct expr *body) {
+struct expr *on_puts(struct arena *arena, struct expr *body) {
     declare_expr_of_type(PUTS);
 
     expr->puts.body = body;
@@ -49,15 +59,15 @@ struct expr *on_puts(struct expr *body) {
     return expr;
 }
 
-struct expr *on_var(struct ident *ident) {
+struct expr *on_var(struct arena *arena, struct ident *ident) {
     declare_expr_of_type(VAR);
 
-    expr->var = ident;
+    expr->var.ident = ident;
 
     return expr;
 }
 
-struct expr *on_conditional(struct expr *cond, struct expr *on_true, struct expr *on_false) {
+struct expr *on_conditional(struct arena *arena, struct expr *cond, struct expr *on_true, struct expr *on_false) {
     declare_expr_of_type(CONDITIONAL);
 
     expr->conditional.cond = cond;
@@ -67,7 +77,7 @@ struct expr *on_conditional(struct expr *cond, struct expr *on_true, struct expr
     return expr;
 }
 
-struct expr *on_func_call(struct ident *ident, struct arg_entry *arg_entries) {
+struct expr *on_func_call(struct arena *arena, struct ident *ident, struct arg_entry *arg_entries) {
     declare_expr_of_type(CALL);
 
     expr->call.args = arg_entries;
@@ -76,8 +86,18 @@ struct expr *on_func_call(struct ident *ident, struct arg_entry *arg_entries) {
     return expr;
 }
 
-struct func *on_func_def(struct ident *ident, struct param_entry *param_entries, struct expr *body) {
-    checked_calloc(struct func, func);
+struct expr *on_let(struct arena *arena, struct ident *ident, struct expr *value, struct expr *body) {
+    declare_expr_of_type(LET);
+
+    expr->let.ident = ident;
+    expr->let.value = value;
+    expr->let.body = body;
+
+    return expr;
+}
+
+struct func *on_func_def(struct arena *arena, struct ident *ident, struct param_entry *param_entries, struct expr *body) {
+    struct func *func = arena_new(arena, struct func);
 
     func->ident = ident;
     func->params = param_entries;
@@ -86,8 +106,8 @@ struct func *on_func_def(struct ident *ident, struct param_entry *param_entries,
     return func;
 }
 
-struct program *on_program(struct definition_entry *definition_entries, struct expr *main_expr) {
-    checked_calloc(struct program, program);
+struct program *on_program(struct arena *arena, struct definition_entry *definition_entries, struct expr *main_expr) {
+    struct program *program = arena_new(arena, struct program);
 
     program->funcs = definition_entries;
     program->expr = main_expr;
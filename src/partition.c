@@ -0,0 +1,176 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <llvm-c/Core.h>
+#include <llvm-c/Target.h>
+
+#include "callgraph.h"
+#include "orc.h"
+#include "partition.h"
+#include "stats.h"
+
+struct partition {
+    struct program *p;
+    // The definitions that this partition defines: count of them, from first.
+    struct definition_entry *first;
+    unsigned long count;
+    // Whether this partition defines __anon_tl.
+    bool anonymous;
+    // Indexed by function index: whether a function is called from outside
+    // its own partition, so must be visible to the others' objects.
+    const bool *external;
+    const struct jit_options *options;
+    // Each thread counts into its own stats, which are added up once it is done.
+    bool stats_enabled;
+    unsigned long ir_instructions_before;
+    unsigned long ir_instructions_after;
+    LLVMMemoryBufferRef object;
+};
+
+void *compile_partition(void *partition_ptr) {
+    struct partition *partition = partition_ptr;
+    struct definition_entry *definition_entry = partition->first;
+
+    stats.enabled = partition->stats_enabled;
+
+    LLVMTargetMachineRef target_machine = create_host_target_machine(partition->options);
+    LLVMModuleRef mod = LLVMModuleCreateWithNameInContext("jit_partition", jit_context());
+
+    // Every function is declared, for calls into other partitions to link to.
+    declare_puts(mod);
+    declare_functions(mod, partition->p->funcs);
+
+    for (unsigned long i = 0; i < partition->count; i++) {
+        struct func *func = definition_entry->value;
+
+        jit_define_definition_entry(mod, definition_entry);
+
+        // As in jit_build_module, the optimisers may then inline, specialise
+        // or drop the function, as all of its calls are in this module.
+        if (!partition->external[func->index]) {
+            LLVMSetLinkage(LLVMGetNamedFunction(mod, func->ident->name), LLVMInternalLinkage);
+        }
+
+        definition_entry = next_entry(definition_entry, struct definition_entry);
+    }
+
+    if (partition->anonymous) {
+        jit_expr_into_anonymous_function(mod, partition->p->expr);
+    }
+
+    jit_set_target(mod, target_machine);
+    verify_module(mod);
+    apply_optimisation_passes(mod, target_machine, partition->options);
+
+    partition->object = jit_emit_object(mod, target_machine);
+    partition->ir_instructions_before = stats.ir_instructions_before;
+    partition->ir_instructions_after = stats.ir_instructions_after;
+
+    LLVMDisposeModule(mod);
+    LLVMDisposeTargetMachine(target_machine);
+    jit_dispose_context();
+
+    return NULL;
+}
+
+struct external_search {
+    bool *external;
+    unsigned long partition_size;
+};
+
+// Calls from the top-level expression, which is in partition 0.
+void find_external_callee(struct call *call, void *search_ptr) {
+    struct external_search *search = search_ptr;
+
+    if (call->func->index / search->partition_size != 0) {
+        search->external[call->func->index] = true;
+    }
+}
+
+// Find which of p's functions are called from a partition other than their
+// own, when each partition holds partition_size consecutive definitions.
+bool *find_external_funcs(struct program *p, unsigned long partition_size) {
+    struct call_graph graph;
+
+    call_graph_init(&graph, p);
+
+    bool *external = calloc(graph.func_count > 0 ? graph.func_count : 1, sizeof(bool));
+    if (external == NULL) { die("calloc failure"); }
+
+    for (unsigned long i = 0; i < graph.func_count; i++) {
+        for (unsigned long j = graph.caller_starts[i]; j < graph.caller_starts[i + 1]; j++) {
+            if (graph.callers[j]->index / partition_size != i / partition_size) {
+                external[i] = true;
+            }
+        }
+    }
+
+    if (p->expr != NULL) {
+        struct external_search search = { external, partition_size };
+        visit_calls(p->expr, find_external_callee, &search);
+    }
+
+    call_graph_free(&graph);
+
+    return external;
+}
+
+void jit_partitioned(struct program *p, unsigned long partitions, const struct jit_options *options) {
+    unsigned long func_count = linked_list_count((struct link *)p->funcs);
+    struct definition_entry *definition_entry = p->funcs;
+
+    // Consecutive definitions share a partition, so that a function can still
+    // be inlined into those defined alongside it.
+    unsigned long partition_size = func_count > partitions ? (func_count + partitions - 1) / partitions : 1;
+    partitions = func_count > 0 ? (func_count + partition_size - 1) / partition_size : 1;
+
+    struct partition *parts = calloc(partitions, sizeof(struct partition));
+    pthread_t *threads = calloc(partitions, sizeof(pthread_t));
+    LLVMMemoryBufferRef *objects = calloc(partitions, sizeof(LLVMMemoryBufferRef));
+    if (parts == NULL || threads == NULL || objects == NULL) { die("calloc failure"); }
+
+    // LLVM's targets are registered once, before any thread looks them up.
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmPrinter();
+
+    phase_switch(PHASE_BUILD);
+
+    bool *external = find_external_funcs(p, partition_size);
+
+    // The threads' building and optimisation count as codegen here.
+    phase_switch(PHASE_CODEGEN);
+
+    for (unsigned long i = 0; i < partitions; i++) {
+        unsigned long remaining = func_count - i * partition_size;
+
+        parts[i].p = p;
+        parts[i].first = definition_entry;
+        parts[i].count = remaining < partition_size ? remaining : partition_size;
+        parts[i].anonymous = i == 0;
+        parts[i].external = external;
+        parts[i].options = options;
+        parts[i].stats_enabled = stats.enabled;
+
+        for (unsigned long j = 0; j < parts[i].count; j++) {
+            definition_entry = next_entry(definition_entry, struct definition_entry);
+        }
+
+        start_thread(&threads[i], compile_partition, &parts[i]);
+    }
+
+    for (unsigned long i = 0; i < partitions; i++) {
+        pthread_join(threads[i], NULL);
+
+        objects[i] = parts[i].object;
+        stats.ir_instructions_before += parts[i].ir_instructions_before;
+        stats.ir_instructions_after += parts[i].ir_instructions_after;
+    }
+
+    orc_run_objects(objects, partitions, options);
+
+    free(external);
+    free(objects);
+    free(threads);
+    free(parts);
+}
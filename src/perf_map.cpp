@@ -0,0 +1,76 @@
+#include <cinttypes>
+#include <cstdio>
+#include <mutex>
+
+#include <unistd.h>
+
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/Object/SymbolSize.h>
+
+#include "perf_map.h"
+
+namespace {
+
+class PerfMapListener : public llvm::JITEventListener {
+    FILE *file = nullptr;
+    // Engines on different threads may load objects at once.
+    std::mutex lock;
+
+public:
+    void notifyObjectLoaded(ObjectKey, const llvm::object::ObjectFile &object,
+                            const llvm::RuntimeDyld::LoadedObjectInfo &info) override {
+        // The copy for debuggers has the addresses that the sections were
+        // loaded at.
+        llvm::object::OwningBinary<llvm::object::ObjectFile> loaded = info.getObjectForDebug(object);
+
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (loaded.getBinary() == nullptr || !open()) {
+            return;
+        }
+
+        for (const auto &symbol_size : llvm::object::computeSymbolSizes(*loaded.getBinary())) {
+            const llvm::object::SymbolRef &symbol = symbol_size.first;
+            uint64_t size = symbol_size.second;
+            llvm::Expected<llvm::object::SymbolRef::Type> type = symbol.getType();
+            llvm::Expected<llvm::StringRef> name = symbol.getName();
+            llvm::Expected<uint64_t> address = symbol.getAddress();
+
+            if (type && *type == llvm::object::SymbolRef::ST_Function && name && address && size > 0) {
+                fprintf(file, "%" PRIx64 " %" PRIx64 " %.*s\n", *address, size, /* Flawfinder: ignore */
+                        static_cast<int>(name->size()), name->data());
+            }
+
+            llvm::consumeError(type.takeError());
+            llvm::consumeError(name.takeError());
+            llvm::consumeError(address.takeError());
+        }
+
+        fflush(file);
+    }
+
+private:
+    bool open() {
+        if (file == nullptr) {
+            char path[64];
+            snprintf(path, sizeof(path), "/tmp/perf-%ld.map", static_cast<long>(getpid()));
+            file = fopen(path, "a"); /* Flawfinder: ignore */
+        }
+
+        return file != nullptr;
+    }
+};
+
+}
+
+LLVMJITEventListenerRef perf_map_listener(void) {
+    // Shared by every engine, for as long as the process runs.
+    static PerfMapListener listener;
+
+    return llvm::wrap(static_cast<llvm::JITEventListener *>(&listener));
+}
+
+void jit_register_event_listener(LLVMExecutionEngineRef engine, LLVMJITEventListenerRef listener) {
+    llvm::unwrap(engine)->RegisterJITEventListener(llvm::unwrap(listener));
+}
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "profile.h"
+
+struct profile_frame {
+    struct profile_record *record;
+    unsigned long started_ns;
+    unsigned long callees_ns;
+};
+
+struct profile_record *profile_records;
+
+// The calls in progress, innermost last.
+struct profile_frame *profile_frames;
+unsigned long profile_depth;
+unsigned long profile_capacity;
+
+unsigned long profile_now_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (unsigned long)now.tv_sec * 1000000000UL + (unsigned long)now.tv_nsec;
+}
+
+void profile_init(struct program *p) {
+    struct definition_entry *definition_entry;
+    unsigned long func_count = linked_list_count((struct link *)p->funcs);
+
+    profile_records = calloc(func_count > 0 ? func_count : 1, sizeof(struct profile_record));
+    if (profile_records == NULL) { die("calloc failure"); }
+
+    for (definition_entry = p->funcs; definition_entry != NULL;
+         definition_entry = next_entry(definition_entry, struct definition_entry)) {
+        definition_entry->value->profile = &profile_records[definition_entry->value->index];
+    }
+}
+
+void profile_free(struct program *p) {
+    struct definition_entry *definition_entry;
+
+    for (definition_entry = p->funcs; definition_entry != NULL;
+         definition_entry = next_entry(definition_entry, struct definition_entry)) {
+        definition_entry->value->profile = NULL;
+    }
+
+    free(profile_records);
+    free(profile_frames);
+    profile_records = NULL;
+    profile_frames = NULL;
+    profile_depth = profile_capacity = 0;
+}
+
+int compare_exclusive_time(const void *a, const void *b) {
+    const struct func *func_a = *(struct func *const *)a;
+    const struct func *func_b = *(struct func *const *)b;
+
+    if (func_a->profile->exclusive_ns != func_b->profile->exclusive_ns) {
+        return func_a->profile->exclusive_ns < func_b->profile->exclusive_ns ? 1 : -1;
+    }
+
+    return func_a->index < func_b->index ? -1 : 1;
+}
+
+void profile_report(struct program *p, FILE *stream) {
+    unsigned long func_count = linked_list_count((struct link *)p->funcs);
+    struct func *funcs[func_count > 0 ? func_count : 1];
+    struct definition_entry *definition_entry;
+    unsigned long called = 0;
+
+    for (definition_entry = p->funcs; definition_entry != NULL;
+         definition_entry = next_entry(definition_entry, struct definition_entry)) {
+        if (definition_entry->value->profile->calls > 0) {
+            funcs[called++] = definition_entry->value;
+        }
+    }
+
+    qsort(funcs, called, sizeof(struct func *), compare_exclusive_time);
+
+    fprintf(stream, "%-24s %12s %14s %14s\n", "function", "calls", "inclusive (s)", "exclusive (s)");
+
+    for (unsigned long i = 0; i < called; i++) {
+        struct profile_record *record = funcs[i]->profile;
+
+        fprintf(stream, "%-24s %12lu %14.6f %14.6f\n", funcs[i]->ident->name, record->calls,
+                (double)record->inclusive_ns / 1e9, (double)record->exclusive_ns / 1e9);
+    }
+}
+
+void nickel_profile_enter(struct profile_record *record) {
+    if (profile_depth == profile_capacity) {
+        profile_capacity = profile_capacity > 0 ? profile_capacity * 2 : 1024;
+        profile_frames = realloc(profile_frames, profile_capacity * sizeof(struct profile_frame));
+        if (profile_frames == NULL) { die("realloc failure"); }
+    }
+
+    record->calls++;
+    record->active++;
+
+    profile_frames[profile_depth++] = (struct profile_frame){ record, profile_now_ns(), 0 };
+}
+
+void nickel_profile_exit(void) {
+    struct profile_frame *frame = &profile_frames[--profile_depth];
+    unsigned long elapsed_ns = profile_now_ns() - frame->started_ns;
+
+    frame->record->exclusive_ns += elapsed_ns - frame->callees_ns;
+
+    if (--frame->record->active == 0) {
+        frame->record->inclusive_ns += elapsed_ns;
+    }
+
+    if (profile_depth > 0) {
+        profile_frames[profile_depth - 1].callees_ns += elapsed_ns;
+    }
+}
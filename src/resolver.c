@@ -0,0 +1,257 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "resolver.h"
+
+// An open-addressing table from function name to definition, so that
+// resolving a CALL costs a hash rather than a scan of every definition. Names
+// are interned, so they are hashed and compared by pointer.
+struct func_table {
+    unsigned long capacity;
+    struct func **funcs;
+};
+
+// A let binding in scope, linked to those that enclose it.
+struct let_scope {
+    struct let *let;
+    struct let_scope *outer;
+};
+
+struct resolver {
+    struct func_table func_table;
+    struct func *current_func;
+    // The innermost let in scope, how many are in scope, and the most that
+    // have been at once in the current function (or top-level expression).
+    struct let_scope *let_scope;
+    unsigned long let_depth;
+    unsigned long local_count;
+    unsigned long error_count;
+    // For a session, finds definitions made by earlier submissions.
+    resolver_lookup lookup;
+    void *lookup_context;
+};
+
+struct func **func_table_slot(struct func_table *table, const struct ident *ident) {
+    unsigned long mask = table->capacity - 1;
+    unsigned long i = hash_bytes(&ident, sizeof(ident)) & mask;
+
+    while (table->funcs[i] != NULL && table->funcs[i]->ident != ident) {
+        i = (i + 1) & mask;
+    }
+
+    return &table->funcs[i];
+}
+
+void func_table_init(struct func_table *table, struct definition_entry *definition_entry) {
+    unsigned long count = linked_list_count((struct link *)definition_entry);
+
+    // Keep the load factor at or below a half.
+    table->capacity = 1;
+    while (table->capacity < count * 2) {
+        table->capacity <<= 1;
+    }
+
+    table->funcs = calloc(table->capacity, sizeof(struct func *));
+    if (table->funcs == NULL) { die("calloc failure"); }
+
+    while (definition_entry != NULL) {
+        struct func **slot = func_table_slot(table, definition_entry->value->ident);
+
+        // As with the original linear lookup, the first definition wins.
+        if (*slot == NULL) {
+            *slot = definition_entry->value;
+        }
+
+        definition_entry = next_entry(definition_entry, struct definition_entry);
+    }
+}
+
+void resolve_var(struct resolver *resolver, struct var *var) {
+    struct func *func = resolver->current_func;
+    bool found = false;
+
+    // The innermost let of the name shadows any other, and any parameter.
+    for (struct let_scope *scope = resolver->let_scope; scope != NULL; scope = scope->outer) {
+        if (scope->let->ident == var->ident) {
+            var->slot = scope->let->slot;
+            return;
+        }
+    }
+
+    if (func != NULL) {
+        struct param_entry *param_entry = func->params;
+
+        // Later parameters shadow earlier ones of the same name.
+        for (unsigned long slot = 0; param_entry != NULL; slot++) {
+            if (param_entry->value == var->ident) {
+                var->slot = slot;
+                found = true;
+            }
+
+            param_entry = next_entry(param_entry, struct param_entry);
+        }
+    }
+
+    if (found) {
+        return;
+    }
+
+    if (func != NULL) {
+        fprintf(error_stream(), "Could not find var %s in stack frame of %s!\n", var->ident->name, func->ident->name);
+    } else {
+        fprintf(error_stream(), "Could not find var %s at top level!\n", var->ident->name);
+    }
+
+    resolver->error_count++;
+}
+
+void resolve_expr(struct resolver *resolver, struct expr *expr);
+
+void resolve_call(struct resolver *resolver, struct call *call) {
+    unsigned long arg_count = 0;
+    struct arg_entry *arg_entry = call->args;
+
+    while (arg_entry != NULL) {
+        resolve_expr(resolver, arg_entry->value);
+        arg_count++;
+
+        arg_entry = next_entry(arg_entry, struct arg_entry);
+    }
+
+    call->func = *func_table_slot(&resolver->func_table, call->callee);
+
+    if (call->func == NULL && resolver->lookup != NULL) {
+        call->func = resolver->lookup(resolver->lookup_context, call->callee);
+    }
+
+    if (call->func == NULL) {
+        fprintf(error_stream(), "Could not find func %s in env!\n", call->callee->name);
+        resolver->error_count++;
+    } else if (call->func->param_count != arg_count) {
+        fprintf(error_stream(), "Unexpected arg count for %s, expected %lu, got %lu args\n",
+                call->callee->name, call->func->param_count, arg_count);
+        resolver->error_count++;
+    }
+}
+
+// A let's slot follows the parameters and those of the lets that enclose it,
+// so the value is not in scope of itself.
+void resolve_let(struct resolver *resolver, struct let *let) {
+    struct let_scope scope = { let, resolver->let_scope };
+    unsigned long param_count = resolver->current_func != NULL ? resolver->current_func->param_count : 0;
+
+    resolve_expr(resolver, let->value);
+
+    let->slot = param_count + resolver->let_depth;
+
+    resolver->let_scope = &scope;
+    resolver->let_depth++;
+
+    if (resolver->let_depth > resolver->local_count) {
+        resolver->local_count = resolver->let_depth;
+    }
+
+    resolve_expr(resolver, let->body);
+
+    resolver->let_depth--;
+    resolver->let_scope = scope.outer;
+}
+
+void resolve_expr(struct resolver *resolver, struct expr *expr) {
+    switch (expr->type) {
+        case LITERAL:
+            break;
+        case VAR:
+            resolve_var(resolver, &expr->var);
+            break;
+        case BINOP:
+            resolve_expr(resolver, expr->binop.l);
+            resolve_expr(resolver, expr->binop.r);
+            break;
+        case CONDITIONAL:
+            resolve_expr(resolver, expr->conditional.cond);
+            resolve_expr(resolver, expr->conditional.on_true);
+            resolve_expr(resolver, expr->conditional.on_false);
+            break;
+        case PUTS:
+            resolve_expr(resolver, expr->puts.body);
+            break;
+        case CALL:
+            resolve_call(resolver, &expr->call);
+            break;
+        case LET:
+            resolve_let(resolver, &expr->let);
+            break;
+    }
+}
+
+// Only the first definition of a name is ever called, so drop any later ones
+// (once their bodies have been resolved, so that their errors are still
+// reported), and number the definitions that remain.
+void drop_redefinitions(struct func_table *table, struct program *p) {
+    struct definition_entry *definition_entry = p->funcs;
+    struct definition_entry *previous = NULL;
+    unsigned long index = 0;
+
+    while (definition_entry != NULL) {
+        struct definition_entry *next = next_entry(definition_entry, struct definition_entry);
+        struct func *func = definition_entry->value;
+
+        if (*func_table_slot(table, func->ident) == func) {
+            func->index = index++;
+            previous = definition_entry;
+        } else if (previous == NULL) {
+            p->funcs = next;
+        } else {
+            set_next(previous, next);
+        }
+
+        definition_entry = next;
+    }
+}
+
+bool resolve_submission(struct program *p, resolver_lookup lookup, void *context) {
+    struct resolver resolver = { { 0, NULL }, NULL, NULL, 0, 0, 0, lookup, context };
+    struct definition_entry *definition_entry = p->funcs;
+
+    // Parameter counts are needed to check the arity of calls to functions
+    // that are defined later in the program.
+    while (definition_entry != NULL) {
+        struct func *func = definition_entry->value;
+        func->param_count = linked_list_count((struct link *)func->params);
+
+        definition_entry = next_entry(definition_entry, struct definition_entry);
+    }
+
+    func_table_init(&resolver.func_table, p->funcs);
+
+    definition_entry = p->funcs;
+
+    while (definition_entry != NULL) {
+        resolver.current_func = definition_entry->value;
+        resolver.local_count = 0;
+        resolve_expr(&resolver, resolver.current_func->body);
+        resolver.current_func->local_count = resolver.local_count;
+
+        definition_entry = next_entry(definition_entry, struct definition_entry);
+    }
+
+    resolver.current_func = NULL;
+    resolver.local_count = 0;
+
+    if (p->expr != NULL) {
+        resolve_expr(&resolver, p->expr);
+    }
+
+    p->local_count = resolver.local_count;
+
+    drop_redefinitions(&resolver.func_table, p);
+    free(resolver.func_table.funcs);
+
+    return resolver.error_count == 0;
+}
+
+bool resolve_program(struct program *p) {
+    return resolve_submission(p, NULL, NULL);
+}
@@ -0,0 +1,94 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "runtime.h"
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+// A 64-bit value is at most 19 digits, plus a sign and a newline.
+#define MAX_LINE_LENGTH 21
+
+// Each thread buffers (and may capture) its own output.
+_Thread_local char nickel_output_buffer[OUTPUT_BUFFER_SIZE];
+_Thread_local size_t nickel_output_length;
+_Thread_local FILE *nickel_output_capture;
+bool nickel_output_unbuffered;
+
+void nickel_flush(void) {
+    size_t written = 0;
+
+    if (nickel_output_capture != NULL) {
+        fwrite(nickel_output_buffer, 1, nickel_output_length, nickel_output_capture);
+        nickel_output_length = 0;
+        return;
+    }
+
+    while (written < nickel_output_length) {
+        ssize_t result = write(STDOUT_FILENO, nickel_output_buffer + written, nickel_output_length - written);
+
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+
+        // There is nowhere to report a failure to write output.
+        if (result <= 0) {
+            break;
+        }
+
+        written += (size_t)result;
+    }
+
+    nickel_output_length = 0;
+}
+
+// Flush whatever is left when the process exits, whether by returning from
+// main or by calling exit.
+__attribute__((destructor)) void nickel_flush_on_exit(void) {
+    nickel_flush();
+}
+
+void nickel_capture_output(FILE *stream) {
+    nickel_flush();
+    nickel_output_capture = stream;
+}
+
+void nickel_set_unbuffered(bool unbuffered) {
+    nickel_flush();
+    nickel_output_unbuffered = unbuffered;
+}
+
+long nickel_puts_i64(long value) {
+    char digits[MAX_LINE_LENGTH];
+    char *start = digits + MAX_LINE_LENGTH;
+    // Negate as unsigned, so that LONG_MIN does not overflow.
+    unsigned long magnitude = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+
+    *--start = '\n';
+
+    do {
+        *--start = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+
+    if (value < 0) {
+        *--start = '-';
+    }
+
+    size_t length = (size_t)(digits + MAX_LINE_LENGTH - start);
+
+    if (nickel_output_length + length > OUTPUT_BUFFER_SIZE) {
+        nickel_flush();
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        nickel_output_buffer[nickel_output_length++] = start[i];
+    }
+
+    if (nickel_output_unbuffered) {
+        nickel_flush();
+    }
+
+    return value;
+}
@@ -0,0 +1,301 @@
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <llvm-c/LLJIT.h>
+#include <llvm-c/Orc.h>
+
+#include "orc.h"
+#include "parser_helpers.h"
+#include "resolver.h"
+#include "runtime.h"
+#include "session.h"
+#include "stats.h"
+#include "symbol_table.h"
+
+#define SESSION_INITIAL_CAPACITY 64
+
+// What a function name refers to: the slot that calls of it go through, and
+// the definition whose code the slot holds (NULL until one has compiled).
+struct session_binding {
+    const struct ident *ident;
+    struct func *func;
+    void **slot;
+    // The submission that is defining the name, so that (as in a program) the
+    // first of several definitions in one submission wins.
+    unsigned long defined_in;
+};
+
+struct session {
+    LLVMOrcLLJITRef jit;
+    LLVMOrcThreadSafeContextRef ts_context;
+    // Every submission is parsed into the one arena, and its identifiers
+    // interned in the one table, so that names compare equal between them.
+    struct arena arena;
+    struct symbol_table symbols;
+    struct session_binding *bindings;
+    unsigned long binding_count;
+    unsigned long binding_capacity;
+    unsigned long submissions;
+};
+
+struct session_binding *session_binding_slot(struct session_binding *bindings, unsigned long capacity,
+                                             const struct ident *ident) {
+    unsigned long mask = capacity - 1;
+    unsigned long i = hash_bytes(&ident, sizeof(ident)) & mask;
+
+    while (bindings[i].ident != NULL && bindings[i].ident != ident) {
+        i = (i + 1) & mask;
+    }
+
+    return &bindings[i];
+}
+
+void session_grow(struct session *session) {
+    unsigned long capacity = session->binding_capacity * 2;
+    struct session_binding *bindings = calloc(capacity, sizeof(struct session_binding));
+    if (bindings == NULL) { die("calloc failure"); }
+
+    for (unsigned long i = 0; i < session->binding_capacity; i++) {
+        if (session->bindings[i].ident != NULL) {
+            *session_binding_slot(bindings, capacity, session->bindings[i].ident) = session->bindings[i];
+        }
+    }
+
+    free(session->bindings);
+    session->bindings = bindings;
+    session->binding_capacity = capacity;
+}
+
+// The binding of ident, created (with an empty slot) if there is none.
+struct session_binding *session_bind(struct session *session, const struct ident *ident) {
+    struct session_binding *binding = session_binding_slot(session->bindings, session->binding_capacity, ident);
+
+    if (binding->ident != NULL) {
+        return binding;
+    }
+
+    // Keep the load factor at or below a half.
+    if ((session->binding_count + 1) * 2 > session->binding_capacity) {
+        session_grow(session);
+        binding = session_binding_slot(session->bindings, session->binding_capacity, ident);
+    }
+
+    binding->ident = ident;
+    binding->slot = arena_new(&session->arena, void *);
+    session->binding_count++;
+
+    return binding;
+}
+
+struct func *session_lookup(void *session_ptr, const struct ident *ident) {
+    struct session *session = session_ptr;
+
+    return session_binding_slot(session->bindings, session->binding_capacity, ident)->func;
+}
+
+void session_init(struct session *session, const struct jit_options *options) {
+    session->jit = orc_create_jit(options);
+    session->ts_context = LLVMOrcCreateNewThreadSafeContext();
+    session->arena = (struct arena){ NULL, 0 };
+    symbol_table_init(&session->symbols, &session->arena);
+    session->binding_count = 0;
+    session->binding_capacity = SESSION_INITIAL_CAPACITY;
+    session->bindings = calloc(session->binding_capacity, sizeof(struct session_binding));
+    if (session->bindings == NULL) { die("calloc failure"); }
+    session->submissions = 0;
+
+    orc_optimise_on_compile(session->jit, options);
+}
+
+void session_free(struct session *session) {
+    // Code in the LLJIT may still refer to the arena's slots until it is gone.
+    orc_check(LLVMOrcDisposeLLJIT(session->jit), "failed to dispose LLJIT");
+    LLVMOrcDisposeThreadSafeContext(session->ts_context);
+    free(session->bindings);
+    symbol_table_free(&session->symbols);
+    arena_free(&session->arena);
+}
+
+// Give value a name unique to the submission, so that redefinitions do not
+// clash with the symbols of earlier submissions.
+void session_rename(LLVMValueRef value, const char *name, unsigned long submission) {
+    size_t name_len = strlen(name); /* Flawfinder: ignore */
+    char unique_name[name_len + sizeof("$18446744073709551615")];
+
+    snprintf(unique_name, sizeof(unique_name), "%s$%lu", name, submission);
+    LLVMSetValueName2(value, unique_name, strlen(unique_name)); /* Flawfinder: ignore */
+}
+
+LLVMOrcExecutorAddress session_lookup_symbol(struct session *session, const char *name, unsigned long submission) {
+    size_t name_len = strlen(name); /* Flawfinder: ignore */
+    char unique_name[name_len + sizeof("$18446744073709551615")];
+    LLVMOrcExecutorAddress address;
+
+    snprintf(unique_name, sizeof(unique_name), "%s$%lu", name, submission);
+    orc_check(LLVMOrcLLJITLookup(session->jit, &address, unique_name), "failed to look up symbol");
+
+    return address;
+}
+
+// Whether p's definitions can replace those of earlier submissions, whose
+// callers were compiled for their number of parameters.
+bool session_check_redefinitions(struct session *session, struct program *p) {
+    struct definition_entry *definition_entry;
+    bool ok = true;
+
+    for (definition_entry = p->funcs; definition_entry != NULL;
+         definition_entry = next_entry(definition_entry, struct definition_entry)) {
+        struct func *func = definition_entry->value;
+        struct func *previous = session_lookup(session, func->ident);
+
+        if (previous != NULL && previous->param_count != func->param_count) {
+            fprintf(error_stream(), "Cannot redefine %s with %lu parameters, as it was defined with %lu\n",
+                    func->ident->name, func->param_count, previous->param_count);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+bool session_submit(struct session *session, const char *text, size_t length) {
+    struct definition_entry *definition_entry;
+    unsigned long submission = ++session->submissions;
+
+    phase_switch(PHASE_PARSE);
+
+    struct program *p = parse_submission(text, length, &session->arena, &session->symbols);
+
+    if (p == NULL || !resolve_submission(p, session_lookup, session) || !session_check_redefinitions(session, p)) {
+        return false;
+    }
+
+    phase_switch(PHASE_BUILD);
+
+    LLVMModuleRef mod = LLVMModuleCreateWithNameInContext(
+        "session_module", LLVMOrcThreadSafeContextGetContext(session->ts_context));
+
+    declare_puts(mod);
+
+    // Every call, even of a function defined alongside it, goes through the
+    // callee's slot.
+    for (definition_entry = p->funcs; definition_entry != NULL;
+         definition_entry = next_entry(definition_entry, struct definition_entry)) {
+        struct session_binding *binding = session_bind(session, definition_entry->value->ident);
+
+        if (binding->defined_in != submission) {
+            binding->defined_in = submission;
+            definition_entry->value->slot = binding->slot;
+            jit_declare_definition_entry(mod, definition_entry);
+        }
+    }
+
+    for (definition_entry = p->funcs; definition_entry != NULL;
+         definition_entry = next_entry(definition_entry, struct definition_entry)) {
+        struct func *func = definition_entry->value;
+
+        if (func->slot != NULL) {
+            jit_define_definition_entry(mod, definition_entry);
+            session_rename(LLVMGetNamedFunction(mod, func->ident->name), func->ident->name, submission);
+        }
+    }
+
+    if (p->expr != NULL) {
+        jit_expr_into_anonymous_function(mod, p->expr);
+        session_rename(LLVMGetNamedFunction(mod, "__anon_tl"), "__anon_tl", submission);
+    }
+
+    orc_add_module(session->jit, session->ts_context, mod);
+
+    // Looking up the first symbol compiles the whole module.
+    phase_switch(PHASE_CODEGEN);
+
+    for (definition_entry = p->funcs; definition_entry != NULL;
+         definition_entry = next_entry(definition_entry, struct definition_entry)) {
+        struct func *func = definition_entry->value;
+
+        if (func->slot != NULL) {
+            struct session_binding *binding = session_bind(session, func->ident);
+
+            *binding->slot = (void *)(uintptr_t)session_lookup_symbol(session, func->ident->name, submission);
+            binding->func = func;
+        }
+    }
+
+    if (p->expr != NULL) {
+        void (*anon_tl)(void) = (void (*)(void))session_lookup_symbol(session, "__anon_tl", submission);
+
+        phase_switch(PHASE_EXECUTE);
+        anon_tl();
+    }
+
+    return true;
+}
+
+// Submit text, abandoning it if it fails (and reporting why).
+bool session_try_submit(struct session *session, const char *text, size_t length) {
+    jmp_buf fail_target;
+
+    set_fail_target(&fail_target);
+
+    bool ok = setjmp(fail_target) == 0 && session_submit(session, text, length);
+
+    set_fail_target(NULL);
+    nickel_flush();
+
+    // Time spent waiting for the next submission belongs to no phase.
+    phase_switch(PHASE_NONE);
+
+    return ok;
+}
+
+unsigned long session(FILE *input, const struct jit_options *options) {
+    struct session session;
+    bool interactive = isatty(fileno(input));
+    char *line = NULL, *text = NULL;
+    size_t line_capacity = 0, text_capacity = 0, text_length = 0;
+    unsigned long failures = 0;
+
+    session_init(&session, options);
+
+    for (;;) {
+        if (interactive) {
+            fputs(text_length == 0 ? "> " : ". ", stderr);
+        }
+
+        ssize_t line_length = getline(&line, &line_capacity, input);
+
+        if (line_length > 0 && !is_blank(line, (size_t)line_length)) {
+            if (text_length + (size_t)line_length > text_capacity) {
+                text_capacity = (text_length + (size_t)line_length) * 2;
+                text = realloc(text, text_capacity);
+                if (text == NULL) { die("realloc failure"); }
+            }
+
+            memcpy(text + text_length, line, (size_t)line_length); /* Flawfinder: ignore */
+            text_length += (size_t)line_length;
+            continue;
+        }
+
+        if (text_length > 0 && !session_try_submit(&session, text, text_length)) {
+            failures++;
+        }
+
+        text_length = 0;
+
+        if (line_length < 0) {
+            break;
+        }
+    }
+
+    free(text);
+    free(line);
+    session_free(&session);
+
+    return failures;
+}
@@ -0,0 +1,683 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC "NKLSNAP\n"
+#define SNAPSHOT_MAGIC_LENGTH (sizeof(SNAPSHOT_MAGIC) - 1)
+#define SNAPSHOT_VERSION 1U
+// Reads back as something else on a machine of the other byte order.
+#define SNAPSHOT_BYTE_ORDER 0x01020304U
+
+// Nothing in an image is more strictly aligned than a pointer.
+#define SNAPSHOT_ALIGNMENT sizeof(void *)
+
+// The records of each kind are stored together, in this order.
+enum snapshot_section {
+    SNAPSHOT_PROGRAM,
+    SNAPSHOT_DEFINITIONS,
+    SNAPSHOT_FUNCS,
+    SNAPSHOT_PARAMS,
+    SNAPSHOT_EXPRS,
+    SNAPSHOT_ARGS,
+    SNAPSHOT_IDENTS,
+    SNAPSHOT_NAMES,
+    SNAPSHOT_SECTION_COUNT,
+};
+
+// Indexed by enum snapshot_section.
+const size_t snapshot_record_sizes[] = {
+    sizeof(struct program), sizeof(struct definition_entry), sizeof(struct func), sizeof(struct param_entry),
+    sizeof(struct expr), sizeof(struct arg_entry), sizeof(struct ident), sizeof(char),
+};
+
+struct snapshot_header {
+    char magic[SNAPSHOT_MAGIC_LENGTH];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t record_sizes[SNAPSHOT_SECTION_COUNT];
+    // Where each section starts in the image, and how many records it holds.
+    uint64_t offsets[SNAPSHOT_SECTION_COUNT];
+    uint64_t counts[SNAPSHOT_SECTION_COUNT];
+};
+
+struct snapshot_writer {
+    struct snapshot_header header;
+    char *image;
+    size_t length;
+    // How many records of each section have been written so far.
+    uint64_t used[SNAPSHOT_SECTION_COUNT];
+    // The program's idents, numbered in the order that they are first seen,
+    // and an open-addressing table from each (by pointer, as they are
+    // interned) to its number plus one.
+    struct ident **idents;
+    unsigned long idents_capacity;
+    unsigned long *ident_table;
+    unsigned long ident_table_capacity;
+};
+
+// Offsets are stored in the image's pointer fields.
+void *snapshot_offset(uint64_t offset) {
+    return (void *)(uintptr_t)offset;
+}
+
+unsigned long *snapshot_ident_slot(struct snapshot_writer *writer, const struct ident *ident) {
+    unsigned long mask = writer->ident_table_capacity - 1;
+    unsigned long i = hash_bytes(&ident, sizeof(ident)) & mask;
+
+    while (writer->ident_table[i] != 0 && writer->idents[writer->ident_table[i] - 1] != ident) {
+        i = (i + 1) & mask;
+    }
+
+    return &writer->ident_table[i];
+}
+
+// Double the size of the ident table, keeping the load factor at or below a
+// half.
+void snapshot_grow_ident_table(struct snapshot_writer *writer) {
+    unsigned long count = writer->header.counts[SNAPSHOT_IDENTS];
+
+    free(writer->ident_table);
+
+    writer->ident_table_capacity = writer->ident_table_capacity ? writer->ident_table_capacity * 2 : 256;
+    writer->ident_table = calloc(writer->ident_table_capacity, sizeof(unsigned long));
+    if (writer->ident_table == NULL) { die("calloc failure"); }
+
+    for (unsigned long i = 0; i < count; i++) {
+        *snapshot_ident_slot(writer, writer->idents[i]) = i + 1;
+    }
+}
+
+// Number ident, if it has not been seen before, and count its name.
+void snapshot_count_ident(struct snapshot_writer *writer, struct ident *ident) {
+    uint64_t *count = &writer->header.counts[SNAPSHOT_IDENTS];
+
+    if (*count * 2 >= writer->ident_table_capacity) {
+        snapshot_grow_ident_table(writer);
+    }
+
+    unsigned long *slot = snapshot_ident_slot(writer, ident);
+
+    if (*slot != 0) {
+        return;
+    }
+
+    if (*count == writer->idents_capacity) {
+        writer->idents_capacity = writer->idents_capacity ? writer->idents_capacity * 2 : 256;
+        writer->idents = realloc(writer->idents, writer->idents_capacity * sizeof(struct ident *));
+        if (writer->idents == NULL) { die("realloc failure"); }
+    }
+
+    writer->idents[*count] = ident;
+    *slot = ++*count;
+    writer->header.counts[SNAPSHOT_NAMES] += strlen(ident->name) + 1; /* Flawfinder: ignore */
+}
+
+void snapshot_count_expr(struct snapshot_writer *writer, struct expr *expr) {
+    struct arg_entry *arg_entry;
+
+    writer->header.counts[SNAPSHOT_EXPRS]++;
+
+    switch (expr->type) {
+        case LITERAL:
+            break;
+        case VAR:
+            snapshot_count_ident(writer, expr->var.ident);
+            break;
+        case BINOP:
+            snapshot_count_expr(writer, expr->binop.l);
+            snapshot_count_expr(writer, expr->binop.r);
+            break;
+        case CONDITIONAL:
+            snapshot_count_expr(writer, expr->conditional.cond);
+            snapshot_count_expr(writer, expr->conditional.on_true);
+            snapshot_count_expr(writer, expr->conditional.on_false);
+            break;
+        case PUTS:
+            snapshot_count_expr(writer, expr->puts.body);
+            break;
+        case CALL:
+            snapshot_count_ident(writer, expr->call.callee);
+            arg_entry = expr->call.args;
+
+            while (arg_entry != NULL) {
+                writer->header.counts[SNAPSHOT_ARGS]++;
+                snapshot_count_expr(writer, arg_entry->value);
+                arg_entry = next_entry(arg_entry, struct arg_entry);
+            }
+            break;
+        case LET:
+            snapshot_count_ident(writer, expr->let.ident);
+            snapshot_count_expr(writer, expr->let.value);
+            snapshot_count_expr(writer, expr->let.body);
+            break;
+    }
+}
+
+// Count the records of every section, and lay the sections out after the
+// header.
+void snapshot_layout(struct snapshot_writer *writer, struct program *p) {
+    struct snapshot_header *header = &writer->header;
+    struct definition_entry *definition_entry;
+    size_t offset = sizeof(struct snapshot_header);
+
+    header->counts[SNAPSHOT_PROGRAM] = 1;
+
+    for (definition_entry = p->funcs; definition_entry != NULL;
+         definition_entry = next_entry(definition_entry, struct definition_entry)) {
+        struct func *func = definition_entry->value;
+        struct param_entry *param_entry;
+
+        header->counts[SNAPSHOT_DEFINITIONS]++;
+        header->counts[SNAPSHOT_FUNCS]++;
+        snapshot_count_ident(writer, func->ident);
+
+        for (param_entry = func->params; param_entry != NULL;
+             param_entry = next_entry(param_entry, struct param_entry)) {
+            header->counts[SNAPSHOT_PARAMS]++;
+            snapshot_count_ident(writer, param_entry->value);
+        }
+
+        snapshot_count_expr(writer, func->body);
+    }
+
+    if (p->expr != NULL) {
+        snapshot_count_expr(writer, p->expr);
+    }
+
+    for (int section = 0; section < SNAPSHOT_SECTION_COUNT; section++) {
+        offset = (offset + SNAPSHOT_ALIGNMENT - 1) & ~(SNAPSHOT_ALIGNMENT - 1);
+
+        header->record_sizes[section] = snapshot_record_sizes[section];
+        header->offsets[section] = offset;
+        offset += header->counts[section] * snapshot_record_sizes[section];
+    }
+
+    writer->length = offset;
+}
+
+// Claim the next record of section, returning its offset in the image.
+uint64_t snapshot_next_record(struct snapshot_writer *writer, enum snapshot_section section) {
+    return writer->header.offsets[section] + writer->used[section]++ * snapshot_record_sizes[section];
+}
+
+void *snapshot_ident_offset(struct snapshot_writer *writer, const struct ident *ident) {
+    unsigned long index = *snapshot_ident_slot(writer, ident) - 1;
+
+    return snapshot_offset(writer->header.offsets[SNAPSHOT_IDENTS] + index * sizeof(struct ident));
+}
+
+void *snapshot_func_offset(struct snapshot_writer *writer, const struct func *func) {
+    return snapshot_offset(writer->header.offsets[SNAPSHOT_FUNCS] + func->index * sizeof(struct func));
+}
+
+uint64_t snapshot_write_expr(struct snapshot_writer *writer, struct expr *expr);
+
+// Write the arg_entries from arg_entry on, returning the offset of the first
+// (or 0 if there are none).
+uint64_t snapshot_write_args(struct snapshot_writer *writer, struct arg_entry *arg_entry) {
+    if (arg_entry == NULL) {
+        return 0;
+    }
+
+    uint64_t offset = snapshot_next_record(writer, SNAPSHOT_ARGS);
+    struct arg_entry *record = (struct arg_entry *)(writer->image + offset);
+
+    record->value = snapshot_offset(snapshot_write_expr(writer, arg_entry->value));
+    set_next(record, snapshot_offset(snapshot_write_args(writer, next_entry(arg_entry, struct arg_entry))));
+
+    return offset;
+}
+
+uint64_t snapshot_write_expr(struct snapshot_writer *writer, struct expr *expr) {
+    uint64_t offset = snapshot_next_record(writer, SNAPSHOT_EXPRS);
+    struct expr *record = (struct expr *)(writer->image + offset);
+
+    *record = *expr;
+
+    switch (expr->type) {
+        case LITERAL:
+            break;
+        case VAR:
+            record->var.ident = snapshot_ident_offset(writer, expr->var.ident);
+            break;
+        case BINOP:
+            record->binop.l = snapshot_offset(snapshot_write_expr(writer, expr->binop.l));
+            record->binop.r = snapshot_offset(snapshot_write_expr(writer, expr->binop.r));
+            break;
+        case CONDITIONAL:
+            record->conditional.cond = snapshot_offset(snapshot_write_expr(writer, expr->conditional.cond));
+            record->conditional.on_true = snapshot_offset(snapshot_write_expr(writer, expr->conditional.on_true));
+            record->conditional.on_false =
+                snapshot_offset(snapshot_write_expr(writer, expr->conditional.on_false));
+            break;
+        case PUTS:
+            record->puts.body = snapshot_offset(snapshot_write_expr(writer, expr->puts.body));
+            break;
+        case CALL:
+            record->call.callee = snapshot_ident_offset(writer, expr->call.callee);
+            record->call.args = snapshot_offset(snapshot_write_args(writer, expr->call.args));
+            record->call.func = snapshot_func_offset(writer, expr->call.func);
+            break;
+        case LET:
+            record->let.ident = snapshot_ident_offset(writer, expr->let.ident);
+            record->let.value = snapshot_offset(snapshot_write_expr(writer, expr->let.value));
+            record->let.body = snapshot_offset(snapshot_write_expr(writer, expr->let.body));
+            break;
+    }
+
+    return offset;
+}
+
+// Write func, and its parameters.
+void snapshot_write_func(struct snapshot_writer *writer, struct func *func) {
+    struct func *record = (struct func *)(writer->image + snapshot_next_record(writer, SNAPSHOT_FUNCS));
+    struct param_entry *param_entry;
+    struct param_entry *last_record = NULL;
+
+    record->ident = snapshot_ident_offset(writer, func->ident);
+    record->params = NULL;
+    record->body = snapshot_offset(snapshot_write_expr(writer, func->body));
+    record->param_count = func->param_count;
+    record->local_count = func->local_count;
+    record->index = func->index;
+
+    for (param_entry = func->params; param_entry != NULL; param_entry = next_entry(param_entry, struct param_entry)) {
+        uint64_t offset = snapshot_next_record(writer, SNAPSHOT_PARAMS);
+        struct param_entry *param_record = (struct param_entry *)(writer->image + offset);
+
+        param_record->value = snapshot_ident_offset(writer, param_entry->value);
+
+        if (last_record == NULL) {
+            record->params = snapshot_offset(offset);
+        } else {
+            set_next(last_record, snapshot_offset(offset));
+        }
+
+        last_record = param_record;
+    }
+}
+
+void snapshot_write(struct program *p, const char *path) {
+    struct snapshot_writer writer;
+    struct definition_entry *definition_entry;
+
+    memset(&writer, 0, sizeof(writer));
+    memcpy(writer.header.magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LENGTH); /* Flawfinder: ignore */
+    writer.header.version = SNAPSHOT_VERSION;
+    writer.header.byte_order = SNAPSHOT_BYTE_ORDER;
+
+    snapshot_layout(&writer, p);
+
+    writer.image = calloc(1, writer.length);
+    if (writer.image == NULL) { die("calloc failure"); }
+
+    memcpy(writer.image, &writer.header, sizeof(writer.header)); /* Flawfinder: ignore */
+
+    // The definition_entries are in the same order as the function table.
+    struct program *program = (struct program *)(writer.image + snapshot_next_record(&writer, SNAPSHOT_PROGRAM));
+    uint64_t funcs_offset = writer.header.offsets[SNAPSHOT_FUNCS];
+
+    for (definition_entry = p->funcs; definition_entry != NULL;
+         definition_entry = next_entry(definition_entry, struct definition_entry)) {
+        uint64_t offset = snapshot_next_record(&writer, SNAPSHOT_DEFINITIONS);
+        struct definition_entry *record = (struct definition_entry *)(writer.image + offset);
+
+        record->value = snapshot_offset(funcs_offset + definition_entry->value->index * sizeof(struct func));
+
+        if (definition_entry->link.next != NULL) {
+            set_next(record, snapshot_offset(offset + sizeof(struct definition_entry)));
+        }
+
+        snapshot_write_func(&writer, definition_entry->value);
+    }
+
+    program->funcs = p->funcs != NULL ? snapshot_offset(writer.header.offsets[SNAPSHOT_DEFINITIONS]) : NULL;
+    program->expr = p->expr != NULL ? snapshot_offset(snapshot_write_expr(&writer, p->expr)) : NULL;
+    program->local_count = p->local_count;
+
+    char *names = writer.image + writer.header.offsets[SNAPSHOT_NAMES];
+
+    for (unsigned long i = 0; i < writer.header.counts[SNAPSHOT_IDENTS]; i++) {
+        struct ident *record = (struct ident *)(writer.image + snapshot_next_record(&writer, SNAPSHOT_IDENTS));
+        size_t length = strlen(writer.idents[i]->name) + 1; /* Flawfinder: ignore */
+
+        record->name = snapshot_offset((uint64_t)(names - writer.image));
+        memcpy(names, writer.idents[i]->name, length); /* Flawfinder: ignore */
+        names += length;
+    }
+
+    FILE *file = fopen(path, "wb"); /* Flawfinder: ignore */
+
+    if (file == NULL || fwrite(writer.image, 1, writer.length, file) != writer.length || fclose(file) != 0) {
+        die("Could not write snapshot %s: %s", path, strerror(errno));
+    }
+
+    free(writer.ident_table);
+    free(writer.idents);
+    free(writer.image);
+}
+
+// The record of section whose offset is stored in field, which may only be 0
+// (for NULL) if nullable.
+void *snapshot_pointer(struct snapshot *snapshot, const void *field, enum snapshot_section section, bool nullable) {
+    const struct snapshot_header *header = snapshot->image;
+    uint64_t offset = (uintptr_t)field;
+    uint64_t size = snapshot_record_sizes[section];
+
+    if (offset == 0 && nullable) {
+        return NULL;
+    }
+
+    if (offset < header->offsets[section] || (offset - header->offsets[section]) % size != 0 ||
+        (offset - header->offsets[section]) / size >= header->counts[section]) {
+        die("Corrupt snapshot: bad reference");
+    }
+
+    return (char *)snapshot->image + offset;
+}
+
+// As snapshot_pointer, but for a record that must come after parent in the
+// same section. The writer lays out every expression's children, and the next
+// entry of every list, after it, so no chain of references can loop.
+void *snapshot_later_pointer(struct snapshot *snapshot, const void *parent, const void *field,
+                             enum snapshot_section section, bool nullable) {
+    void *pointer = snapshot_pointer(snapshot, field, section, nullable);
+
+    if (pointer != NULL && (const char *)pointer <= (const char *)parent) {
+        die("Corrupt snapshot: bad reference");
+    }
+
+    return pointer;
+}
+
+void snapshot_relocate_expr(struct snapshot *snapshot, struct expr *expr) {
+    if ((unsigned)expr->type > LET || (expr->type == BINOP && (unsigned)expr->binop.type > EQ)) {
+        die("Corrupt snapshot: bad expression");
+    }
+
+    switch (expr->type) {
+        case LITERAL:
+            break;
+        case VAR:
+            expr->var.ident = snapshot_pointer(snapshot, expr->var.ident, SNAPSHOT_IDENTS, false);
+            break;
+        case BINOP:
+            expr->binop.l = snapshot_later_pointer(snapshot, expr, expr->binop.l, SNAPSHOT_EXPRS, false);
+            expr->binop.r = snapshot_later_pointer(snapshot, expr, expr->binop.r, SNAPSHOT_EXPRS, false);
+            break;
+        case CONDITIONAL:
+            expr->conditional.cond =
+                snapshot_later_pointer(snapshot, expr, expr->conditional.cond, SNAPSHOT_EXPRS, false);
+            expr->conditional.on_true =
+                snapshot_later_pointer(snapshot, expr, expr->conditional.on_true, SNAPSHOT_EXPRS, false);
+            expr->conditional.on_false =
+                snapshot_later_pointer(snapshot, expr, expr->conditional.on_false, SNAPSHOT_EXPRS, false);
+            break;
+        case PUTS:
+            expr->puts.body = snapshot_later_pointer(snapshot, expr, expr->puts.body, SNAPSHOT_EXPRS, false);
+            break;
+        case CALL:
+            expr->call.callee = snapshot_pointer(snapshot, expr->call.callee, SNAPSHOT_IDENTS, false);
+            expr->call.args = snapshot_pointer(snapshot, expr->call.args, SNAPSHOT_ARGS, true);
+            expr->call.func = snapshot_pointer(snapshot, expr->call.func, SNAPSHOT_FUNCS, false);
+            break;
+        case LET:
+            expr->let.ident = snapshot_pointer(snapshot, expr->let.ident, SNAPSHOT_IDENTS, false);
+            expr->let.value = snapshot_later_pointer(snapshot, expr, expr->let.value, SNAPSHOT_EXPRS, false);
+            expr->let.body = snapshot_later_pointer(snapshot, expr, expr->let.body, SNAPSHOT_EXPRS, false);
+            break;
+    }
+}
+
+// Check that the header describes an image that this build can use, with
+// every section within it.
+void snapshot_check_header(struct snapshot *snapshot, const char *path) {
+    const struct snapshot_header *header = snapshot->image;
+
+    if (snapshot->length < sizeof(struct snapshot_header) ||
+        memcmp(header->magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LENGTH) != 0) {
+        die("%s is not a snapshot", path);
+    }
+
+    bool compatible = header->version == SNAPSHOT_VERSION && header->byte_order == SNAPSHOT_BYTE_ORDER;
+
+    for (int section = 0; section < SNAPSHOT_SECTION_COUNT; section++) {
+        compatible = compatible && header->record_sizes[section] == snapshot_record_sizes[section];
+    }
+
+    if (!compatible) {
+        die("%s was written by an incompatible build of nickel", path);
+    }
+
+    uint64_t end = sizeof(struct snapshot_header);
+
+    // The sections follow the header, in order, without overlapping.
+    for (int section = 0; section < SNAPSHOT_SECTION_COUNT; section++) {
+        uint64_t offset = header->offsets[section];
+
+        if (offset % SNAPSHOT_ALIGNMENT != 0 || offset < end || offset > snapshot->length ||
+            header->counts[section] > (snapshot->length - offset) / snapshot_record_sizes[section]) {
+            die("Corrupt snapshot: %s is truncated", path);
+        }
+
+        end = offset + header->counts[section] * snapshot_record_sizes[section];
+    }
+
+    uint64_t names_length = header->counts[SNAPSHOT_NAMES];
+    const char *names = (const char *)snapshot->image + header->offsets[SNAPSHOT_NAMES];
+
+    // Every name ends within the image.
+    if (header->counts[SNAPSHOT_PROGRAM] != 1 || (names_length > 0 && names[names_length - 1] != '\0')) {
+        die("Corrupt snapshot: %s", path);
+    }
+}
+
+// Turn every offset in the image into a pointer, checking that each refers to
+// a record of the right kind.
+void snapshot_relocate(struct snapshot *snapshot) {
+    const struct snapshot_header *header = snapshot->image;
+    char *image = snapshot->image;
+
+    struct program *p = (struct program *)(image + header->offsets[SNAPSHOT_PROGRAM]);
+    p->funcs = snapshot_pointer(snapshot, p->funcs, SNAPSHOT_DEFINITIONS, true);
+    p->expr = snapshot_pointer(snapshot, p->expr, SNAPSHOT_EXPRS, true);
+    p->arena = (struct arena){ NULL, 0 };
+
+    struct definition_entry *definitions = (struct definition_entry *)(image + header->offsets[SNAPSHOT_DEFINITIONS]);
+    for (uint64_t i = 0; i < header->counts[SNAPSHOT_DEFINITIONS]; i++) {
+        struct definition_entry *definition_entry = &definitions[i];
+
+        set_next(definition_entry, snapshot_later_pointer(snapshot, definition_entry, definition_entry->link.next,
+                                                          SNAPSHOT_DEFINITIONS, true));
+        definition_entry->value = snapshot_pointer(snapshot, definition_entry->value, SNAPSHOT_FUNCS, false);
+    }
+
+    struct func *funcs = (struct func *)(image + header->offsets[SNAPSHOT_FUNCS]);
+    for (uint64_t i = 0; i < header->counts[SNAPSHOT_FUNCS]; i++) {
+        struct func *func = &funcs[i];
+
+        // The backends index their tables of functions by index.
+        if (func->index != i) {
+            die("Corrupt snapshot: bad function index");
+        }
+
+        func->ident = snapshot_pointer(snapshot, func->ident, SNAPSHOT_IDENTS, false);
+        func->params = snapshot_pointer(snapshot, func->params, SNAPSHOT_PARAMS, true);
+        func->body = snapshot_pointer(snapshot, func->body, SNAPSHOT_EXPRS, false);
+        // As with the program itself, what the analyses find is not trusted
+        // from the image, but found again by the loader's caller.
+        func->pure = false;
+        func->terminates = false;
+        func->readnone = false;
+        func->memo = NULL;
+        func->profile = NULL;
+        func->slot = NULL;
+    }
+
+    struct param_entry *param_entries = (struct param_entry *)(image + header->offsets[SNAPSHOT_PARAMS]);
+    for (uint64_t i = 0; i < header->counts[SNAPSHOT_PARAMS]; i++) {
+        struct param_entry *param_entry = &param_entries[i];
+
+        set_next(param_entry,
+                 snapshot_later_pointer(snapshot, param_entry, param_entry->link.next, SNAPSHOT_PARAMS, true));
+        param_entry->value = snapshot_pointer(snapshot, param_entry->value, SNAPSHOT_IDENTS, false);
+    }
+
+    struct expr *exprs = (struct expr *)(image + header->offsets[SNAPSHOT_EXPRS]);
+    for (uint64_t i = 0; i < header->counts[SNAPSHOT_EXPRS]; i++) {
+        snapshot_relocate_expr(snapshot, &exprs[i]);
+    }
+
+    struct arg_entry *arg_entries = (struct arg_entry *)(image + header->offsets[SNAPSHOT_ARGS]);
+    for (uint64_t i = 0; i < header->counts[SNAPSHOT_ARGS]; i++) {
+        struct arg_entry *arg_entry = &arg_entries[i];
+
+        set_next(arg_entry, snapshot_later_pointer(snapshot, arg_entry, arg_entry->link.next, SNAPSHOT_ARGS, true));
+        arg_entry->value = snapshot_pointer(snapshot, arg_entry->value, SNAPSHOT_EXPRS, false);
+    }
+
+    struct ident *idents = (struct ident *)(image + header->offsets[SNAPSHOT_IDENTS]);
+    for (uint64_t i = 0; i < header->counts[SNAPSHOT_IDENTS]; i++) {
+        idents[i].name = snapshot_pointer(snapshot, idents[i].name, SNAPSHOT_NAMES, false);
+    }
+}
+
+// Check that expr, in a frame of frame_size slots, only uses slots of the
+// frame, and only calls functions with as many arguments as they take. Each
+// expression is checked at most once (as the writer never shares one), which
+// *unchecked counts down.
+void snapshot_check_expr(struct expr *expr, unsigned long frame_size, uint64_t *unchecked) {
+    struct arg_entry *arg_entry;
+    unsigned long arg_count = 0;
+
+    if (*unchecked == 0) {
+        die("Corrupt snapshot: shared expression");
+    }
+
+    --*unchecked;
+
+    switch (expr->type) {
+        case LITERAL:
+            break;
+        case VAR:
+            if (expr->var.slot >= frame_size) {
+                die("Corrupt snapshot: bad variable slot");
+            }
+            break;
+        case BINOP:
+            snapshot_check_expr(expr->binop.l, frame_size, unchecked);
+            snapshot_check_expr(expr->binop.r, frame_size, unchecked);
+            break;
+        case CONDITIONAL:
+            snapshot_check_expr(expr->conditional.cond, frame_size, unchecked);
+            snapshot_check_expr(expr->conditional.on_true, frame_size, unchecked);
+            snapshot_check_expr(expr->conditional.on_false, frame_size, unchecked);
+            break;
+        case PUTS:
+            snapshot_check_expr(expr->puts.body, frame_size, unchecked);
+            break;
+        case CALL:
+            for (arg_entry = expr->call.args; arg_entry != NULL;
+                 arg_entry = next_entry(arg_entry, struct arg_entry)) {
+                // Arguments are written after their call, like any child.
+                if (arg_entry->value <= expr) {
+                    die("Corrupt snapshot: bad reference");
+                }
+
+                snapshot_check_expr(arg_entry->value, frame_size, unchecked);
+                arg_count++;
+            }
+
+            if (arg_count != expr->call.func->param_count) {
+                die("Corrupt snapshot: bad call of %s", expr->call.func->ident->name);
+            }
+            break;
+        case LET:
+            if (expr->let.slot >= frame_size) {
+                die("Corrupt snapshot: bad let slot");
+            }
+
+            snapshot_check_expr(expr->let.value, frame_size, unchecked);
+            snapshot_check_expr(expr->let.body, frame_size, unchecked);
+            break;
+    }
+}
+
+// Check, once every reference in the image is known to be to a record of the
+// right kind, that the program it holds could have been resolved by nickel.
+void snapshot_check_program(struct snapshot *snapshot, struct program *p) {
+    const struct snapshot_header *header = snapshot->image;
+    struct func *funcs = (struct func *)((char *)snapshot->image + header->offsets[SNAPSHOT_FUNCS]);
+    uint64_t unchecked = header->counts[SNAPSHOT_EXPRS];
+
+    for (uint64_t i = 0; i < header->counts[SNAPSHOT_FUNCS]; i++) {
+        struct func *func = &funcs[i];
+
+        if (linked_list_count((struct link *)func->params) != func->param_count ||
+            func->param_count + func->local_count < func->param_count) {
+            die("Corrupt snapshot: bad function %s", func->ident->name);
+        }
+
+        snapshot_check_expr(func->body, func->param_count + func->local_count, &unchecked);
+    }
+
+    if (p->expr != NULL) {
+        snapshot_check_expr(p->expr, p->local_count, &unchecked);
+    }
+}
+
+struct program *snapshot_load(const char *path, struct snapshot *snapshot) {
+    struct stat st;
+    int fd = open(path, O_RDONLY); /* Flawfinder: ignore */
+
+    if (fd < 0) {
+        die("Could not open %s: %s", path, strerror(errno));
+    }
+
+    if (fstat(fd, &st) != 0) {
+        int error = errno;
+        close(fd);
+        die("Could not open %s: %s", path, strerror(error));
+    }
+
+    if (!S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(struct snapshot_header)) {
+        close(fd);
+        die("%s is not a snapshot", path);
+    }
+
+    // A private mapping, as relocating writes to it; only the pages that it
+    // writes are copied.
+    snapshot->length = (size_t)st.st_size;
+    snapshot->image = mmap(NULL, snapshot->length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (snapshot->image == MAP_FAILED) {
+        die("Could not map %s: %s", path, strerror(errno));
+    }
+
+    snapshot_check_header(snapshot, path);
+    snapshot_relocate(snapshot);
+
+    const struct snapshot_header *header = snapshot->image;
+    struct program *p = (struct program *)((char *)snapshot->image + header->offsets[SNAPSHOT_PROGRAM]);
+
+    snapshot_check_program(snapshot, p);
+
+    return p;
+}
+
+void snapshot_free(struct snapshot *snapshot) {
+    munmap(snapshot->image, snapshot->length);
+
+    snapshot->image = NULL;
+    snapshot->length = 0;
+}
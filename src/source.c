@@ -0,0 +1,110 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "helpers.h"
+#include "source.h"
+
+void read_source(FILE *file, struct source *source) {
+    size_t capacity = 4096;
+
+    source->text = malloc(capacity);
+    source->length = 0;
+    source->mapped = false;
+    if (source->text == NULL) { die("malloc failure"); }
+
+    for (;;) {
+        source->length += fread(source->text + source->length, 1, capacity - source->length, file);
+
+        if (source->length < capacity - SOURCE_PADDING) {
+            break;
+        }
+
+        capacity *= 2;
+        source->text = realloc(source->text, capacity);
+        if (source->text == NULL) { die("realloc failure"); }
+    }
+
+    if (ferror(file)) {
+        die("Failed to read program source");
+    }
+
+    memset(source->text + source->length, 0, SOURCE_PADDING);
+}
+
+void copy_source(const char *text, size_t length, struct source *source) {
+    source->text = malloc(length + SOURCE_PADDING);
+    source->length = length;
+    source->mapped = false;
+    if (source->text == NULL) { die("malloc failure"); }
+
+    memcpy(source->text, text, length); /* Flawfinder: ignore */
+    memset(source->text + length, 0, SOURCE_PADDING);
+}
+
+void map_source(const char *path, struct source *source) {
+    struct stat st;
+    int fd = open(path, O_RDONLY); /* Flawfinder: ignore */
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    if (fd < 0) {
+        die("Could not open %s: %s", path, strerror(errno));
+    }
+
+    if (fstat(fd, &st) != 0) {
+        int error = errno;
+        close(fd);
+        die("Could not open %s: %s", path, strerror(error));
+    }
+
+    // A mapping reads as zeros past the end of the file, up to the end of its
+    // last page, which is where the padding goes. Files with no room for it
+    // (and those that, like pipes, have no size) are read instead.
+    size_t spare = page_size - (size_t)st.st_size % page_size;
+
+    if (!S_ISREG(st.st_mode) || spare < SOURCE_PADDING || spare == page_size) {
+        FILE *file = fdopen(fd, "rb");
+
+        if (file == NULL) {
+            int error = errno;
+            close(fd);
+            die("Could not open %s: %s", path, strerror(error));
+        }
+
+        read_source(file, source);
+        fclose(file);
+        return;
+    }
+
+    // Private and writable, as the lexer marks the end of each token in the
+    // text while it scans it. Only the pages that it writes to are copied.
+    source->text = mmap(NULL, (size_t)st.st_size + SOURCE_PADDING, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    source->length = (size_t)st.st_size;
+    source->mapped = true;
+
+    close(fd);
+
+    if (source->text == MAP_FAILED) {
+        die("Could not map %s: %s", path, strerror(errno));
+    }
+
+    // The lexer reads straight through the program once.
+    madvise(source->text, source->length, MADV_SEQUENTIAL);
+}
+
+void free_source(struct source *source) {
+    if (source->mapped) {
+        munmap(source->text, source->length + SOURCE_PADDING);
+    } else {
+        free(source->text);
+    }
+
+    source->text = NULL;
+    source->length = 0;
+    source->mapped = false;
+}
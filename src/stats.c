@@ -0,0 +1,229 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <llvm-c/Core.h>
+#include <llvm-c/Object.h>
+
+#include "helpers.h"
+#include "stats.h"
+
+const char *phase_names[PHASE_COUNT] = {
+    "none", "parse", "ast_optimise", "build", "verify", "optimise", "codegen", "execute",
+};
+
+_Thread_local struct stats stats;
+
+_Thread_local enum phase current_phase = PHASE_NONE;
+_Thread_local struct timespec phase_started_wall;
+_Thread_local struct timespec phase_started_cpu;
+_Thread_local double phase_wall_seconds[PHASE_COUNT];
+_Thread_local double phase_cpu_seconds[PHASE_COUNT];
+
+double seconds_between(struct timespec start, struct timespec end) {
+    return (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+enum phase phase_switch(enum phase phase) {
+    enum phase previous = current_phase;
+    struct timespec wall, cpu;
+
+    clock_gettime(CLOCK_MONOTONIC, &wall);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+
+    if (current_phase != PHASE_NONE) {
+        phase_wall_seconds[current_phase] += seconds_between(phase_started_wall, wall);
+        phase_cpu_seconds[current_phase] += seconds_between(phase_started_cpu, cpu);
+    }
+
+    current_phase = phase;
+    phase_started_wall = wall;
+    phase_started_cpu = cpu;
+
+    return previous;
+}
+
+void stats_count_calls(unsigned long calls, unsigned long max_call_depth) {
+    stats.calls += calls;
+
+    if (max_call_depth > stats.max_call_depth) {
+        stats.max_call_depth = max_call_depth;
+    }
+}
+
+unsigned long count_ir_instructions(LLVMModuleRef mod) {
+    unsigned long count = 0;
+
+    for (LLVMValueRef f = LLVMGetFirstFunction(mod); f != NULL; f = LLVMGetNextFunction(f)) {
+        for (LLVMBasicBlockRef block = LLVMGetFirstBasicBlock(f); block != NULL; block = LLVMGetNextBasicBlock(block)) {
+            for (LLVMValueRef inst = LLVMGetFirstInstruction(block); inst != NULL; inst = LLVMGetNextInstruction(inst)) {
+                count++;
+            }
+        }
+    }
+
+    return count;
+}
+
+unsigned long count_code_bytes(LLVMMemoryBufferRef object) {
+    unsigned long count = 0;
+    char *error = NULL;
+    LLVMBinaryRef binary = LLVMCreateBinary(object, NULL, &error);
+
+    if (binary == NULL) {
+        die("failed to read object: %s", error);
+    }
+
+    LLVMSectionIteratorRef section = LLVMObjectFileCopySectionIterator(binary);
+
+    for (; !LLVMObjectFileIsSectionIteratorAtEnd(binary, section); LLVMMoveToNextSection(section)) {
+        const char *name = LLVMGetSectionName(section);
+
+        if (name != NULL && strncmp(name, ".text", strlen(".text")) == 0) { /* Flawfinder: ignore */
+            count += LLVMGetSectionSize(section);
+        }
+    }
+
+    LLVMDisposeSectionIterator(section);
+    LLVMDisposeBinary(binary);
+
+    return count;
+}
+
+// Each section is mapped read-write, and made executable or read-only when
+// MCJIT finalises its memory.
+struct code_section {
+    struct code_section *next;
+    void *address;
+    size_t length;
+    int protection;
+};
+
+uint8_t *allocate_section(void *sections_ptr, uintptr_t size, unsigned alignment, int protection) {
+    struct code_section **sections = sections_ptr;
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t length = (size + page_size - 1) / page_size * page_size;
+
+    // Mappings are page aligned, which is as aligned as any section needs.
+    if (alignment > page_size) {
+        die("cannot align a section to %u bytes", alignment);
+    }
+
+    checked_calloc(struct code_section, section);
+
+    section->address = mmap(NULL, length > 0 ? length : page_size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (section->address == MAP_FAILED) { die("mmap failure"); }
+
+    section->length = length > 0 ? length : page_size;
+    section->protection = protection;
+    section->next = *sections;
+    *sections = section;
+
+    return section->address;
+}
+
+uint8_t *allocate_code_section(void *sections, uintptr_t size, unsigned alignment,
+                               __attribute__((unused)) unsigned section_id,
+                               __attribute__((unused)) const char *section_name) {
+    stats.machine_code_bytes += size;
+
+    return allocate_section(sections, size, alignment, PROT_READ | PROT_EXEC);
+}
+
+uint8_t *allocate_data_section(void *sections, uintptr_t size, unsigned alignment,
+                               __attribute__((unused)) unsigned section_id,
+                               __attribute__((unused)) const char *section_name, LLVMBool read_only) {
+    return allocate_section(sections, size, alignment, read_only ? PROT_READ : PROT_READ | PROT_WRITE);
+}
+
+LLVMBool finalize_sections(void *sections_ptr, char **error) {
+    struct code_section **sections = sections_ptr;
+
+    for (struct code_section *section = *sections; section != NULL; section = section->next) {
+        if (mprotect(section->address, section->length, section->protection) != 0) {
+            *error = strdup("mprotect failure");
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void destroy_sections(void *sections_ptr) {
+    struct code_section **sections = sections_ptr;
+    struct code_section *section = *sections;
+
+    while (section != NULL) {
+        struct code_section *next = section->next;
+        munmap(section->address, section->length);
+        free(section);
+        section = next;
+    }
+
+    free(sections);
+}
+
+LLVMMCJITMemoryManagerRef create_counting_memory_manager(void) {
+    struct code_section **sections = calloc(1, sizeof(struct code_section *));
+    if (sections == NULL) { die("calloc failure"); }
+
+    return LLVMCreateSimpleMCJITMemoryManager(
+        sections, allocate_code_section, allocate_data_section, finalize_sections, destroy_sections);
+}
+
+struct counter { const char *name; unsigned long value; };
+
+void stats_report(FILE *stream, bool json) {
+    struct counter counters[] = {
+        { "source_bytes", stats.source_bytes },
+        { "parser_bytes", stats.parser_bytes },
+        { "ast_nodes_parsed", stats.ast_nodes_parsed },
+        { "ast_nodes_optimised", stats.ast_nodes_optimised },
+        { "ir_instructions_before", stats.ir_instructions_before },
+        { "ir_instructions_after", stats.ir_instructions_after },
+        { "machine_code_bytes", stats.machine_code_bytes },
+        { "calls", stats.calls },
+        { "max_call_depth", stats.max_call_depth },
+    };
+    double total_wall = 0, total_cpu = 0;
+
+    phase_switch(PHASE_NONE);
+
+    if (json) {
+        fputs("{\"phases\": {", stream);
+    } else {
+        fprintf(stream, "%-24s %12s %12s\n", "phase", "wall (s)", "cpu (s)");
+    }
+
+    for (int phase = PHASE_PARSE; phase < PHASE_COUNT; phase++) {
+        if (json) {
+            fprintf(stream, "%s\"%s\": {\"wall\": %.6f, \"cpu\": %.6f}", phase == PHASE_PARSE ? "" : ", ",
+                    phase_names[phase], phase_wall_seconds[phase], phase_cpu_seconds[phase]);
+        } else {
+            fprintf(stream, "%-24s %12.6f %12.6f\n",
+                    phase_names[phase], phase_wall_seconds[phase], phase_cpu_seconds[phase]);
+        }
+
+        total_wall += phase_wall_seconds[phase];
+        total_cpu += phase_cpu_seconds[phase];
+    }
+
+    if (json) {
+        fputs("}", stream);
+    } else {
+        fprintf(stream, "%-24s %12.6f %12.6f\n\n", "total", total_wall, total_cpu);
+    }
+
+    for (unsigned long i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        fprintf(stream, json ? ", \"%s\": %lu" : "%-24s %12lu\n", counters[i].name, counters[i].value);
+    }
+
+    if (json) {
+        fputs("}\n", stream);
+    }
+}
@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "symbol_table.h"
+
+#define SYMBOL_TABLE_INITIAL_CAPACITY 256
+
+struct symbol {
+    struct ident *ident;
+    size_t length;
+    unsigned long hash;
+};
+
+void symbol_table_init(struct symbol_table *table, struct arena *arena) {
+    table->arena = arena;
+    table->count = 0;
+    table->capacity = SYMBOL_TABLE_INITIAL_CAPACITY;
+    table->symbols = calloc(table->capacity, sizeof(struct symbol));
+    if (table->symbols == NULL) { die("calloc failure"); }
+}
+
+void symbol_table_free(struct symbol_table *table) {
+    free(table->symbols);
+    table->symbols = NULL;
+    table->count = table->capacity = 0;
+}
+
+struct symbol *symbol_table_slot(struct symbol *symbols, unsigned long capacity, const char *name, size_t length,
+                                 unsigned long hash) {
+    unsigned long mask = capacity - 1;
+    unsigned long i = hash & mask;
+
+    while (symbols[i].ident != NULL &&
+           (symbols[i].hash != hash || symbols[i].length != length ||
+            memcmp(symbols[i].ident->name, name, length) != 0)) {
+        i = (i + 1) & mask;
+    }
+
+    return &symbols[i];
+}
+
+void symbol_table_grow(struct symbol_table *table) {
+    unsigned long capacity = table->capacity * 2;
+    struct symbol *symbols = calloc(capacity, sizeof(struct symbol));
+    if (symbols == NULL) { die("calloc failure"); }
+
+    for (unsigned long i = 0; i < table->capacity; i++) {
+        struct symbol *symbol = &table->symbols[i];
+
+        if (symbol->ident != NULL) {
+            *symbol_table_slot(symbols, capacity, symbol->ident->name, symbol->length, symbol->hash) = *symbol;
+        }
+    }
+
+    free(table->symbols);
+    table->symbols = symbols;
+    table->capacity = capacity;
+}
+
+struct ident *intern(struct symbol_table *table, const char *name, size_t length) {
+    unsigned long hash = hash_bytes(name, length);
+    struct symbol *symbol = symbol_table_slot(table->symbols, table->capacity, name, length, hash);
+
+    if (symbol->ident != NULL) {
+        return symbol->ident;
+    }
+
+    // Keep the load factor at or below a half.
+    if ((table->count + 1) * 2 > table->capacity) {
+        symbol_table_grow(table);
+        symbol = symbol_table_slot(table->symbols, table->capacity, name, length, hash);
+    }
+
+    symbol->ident = arena_new(table->arena, struct ident);
+    symbol->ident->name = arena_strndup(table->arena, name, length);
+    symbol->length = length;
+    symbol->hash = hash;
+    table->count++;
+
+    return symbol->ident;
+}
@@ -0,0 +1,127 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "callgraph.h"
+#include "jit.h"
+#include "stats.h"
+#include "tiering.h"
+
+struct tier_compiler {
+    unsigned long func_count;
+    struct func **funcs;
+    // Each compiled function has its own engine, which must outlive any call
+    // of its code.
+    LLVMExecutionEngineRef *engines;
+    unsigned long engine_count;
+    const struct jit_options *options;
+};
+
+void collect_reachable(struct call *call, void *reachable_ptr) {
+    bool *reachable = reachable_ptr;
+    struct func *func = call->func;
+
+    if (reachable[func->index]) {
+        return;
+    }
+
+    reachable[func->index] = true;
+    visit_calls(func->body, collect_reachable, reachable);
+}
+
+native_func tier_compile(void *compiler_ptr, struct func *func) {
+    struct tier_compiler *compiler = compiler_ptr;
+    bool reachable[compiler->func_count];
+    struct definition_entry definition_entry;
+
+    phase_switch(PHASE_BUILD);
+
+    for (unsigned long i = 0; i < compiler->func_count; i++) {
+        reachable[i] = false;
+    }
+
+    // Only func and the functions it can call need to be compiled.
+    reachable[func->index] = true;
+    visit_calls(func->body, collect_reachable, reachable);
+
+    LLVMModuleRef mod = LLVMModuleCreateWithNameInContext(func->ident->name, jit_context());
+    declare_puts(mod);
+
+    for (unsigned long i = 0; i < compiler->func_count; i++) {
+        if (reachable[i]) {
+            definition_entry.value = compiler->funcs[i];
+            jit_declare_definition_entry(mod, &definition_entry);
+        }
+    }
+
+    for (unsigned long i = 0; i < compiler->func_count; i++) {
+        if (reachable[i]) {
+            definition_entry.value = compiler->funcs[i];
+            jit_define_definition_entry(mod, &definition_entry);
+        }
+    }
+
+    jit_frame_entry(mod, func, "__tier_entry");
+
+    verify_module(mod);
+    apply_optimisation_passes(mod, NULL, compiler->options);
+
+    phase_switch(PHASE_CODEGEN);
+
+    LLVMExecutionEngineRef engine = create_execution_engine(mod, compiler->options);
+    compiler->engines[compiler->engine_count++] = engine;
+
+    native_func native = (native_func)LLVMGetFunctionAddress(engine, "__tier_entry");
+
+    phase_switch(PHASE_EXECUTE);
+
+    return native;
+}
+
+void tiered(struct program *p, unsigned long max_depth, unsigned long threshold,
+            const struct jit_options *options) {
+    struct tier_compiler compiler;
+    struct tiering tiering;
+    struct environment env;
+    struct definition_entry *definition_entry = p->funcs;
+
+    compiler.func_count = linked_list_count((struct link *)p->funcs);
+    compiler.funcs = calloc(compiler.func_count, sizeof(struct func *));
+    compiler.engines = calloc(compiler.func_count, sizeof(LLVMExecutionEngineRef));
+    compiler.engine_count = 0;
+    compiler.options = options;
+
+    tiering.threshold = threshold;
+    tiering.call_counts = calloc(compiler.func_count, sizeof(unsigned long));
+    tiering.native_funcs = calloc(compiler.func_count, sizeof(native_func));
+    tiering.compile = tier_compile;
+    tiering.compiler = &compiler;
+
+    if (compiler.func_count > 0 &&
+        (compiler.funcs == NULL || compiler.engines == NULL ||
+         tiering.call_counts == NULL || tiering.native_funcs == NULL)) {
+        die("calloc failure");
+    }
+
+    while (definition_entry != NULL) {
+        compiler.funcs[definition_entry->value->index] = definition_entry->value;
+        definition_entry = next_entry(definition_entry, struct definition_entry);
+    }
+
+    init_environment(&env, p, max_depth);
+    env.tiering = &tiering;
+
+    phase_switch(PHASE_EXECUTE);
+    interpret_expr(&env, p->expr);
+
+    free_environment(&env);
+
+    for (unsigned long i = 0; i < compiler.engine_count; i++) {
+        LLVMDisposeExecutionEngine(compiler.engines[i]);
+    }
+
+    free(tiering.native_funcs);
+    free(tiering.call_counts);
+    free(compiler.engines);
+    free(compiler.funcs);
+}
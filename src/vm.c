@@ -0,0 +1,388 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "runtime.h"
+#include "stats.h"
+#include "vm.h"
+
+#define VM_STACK_SIZE (1UL << 20)
+
+// A let binding in scope: its value stays on the stack, at position in the
+// frame, while its body runs.
+struct vm_scope {
+    unsigned long slot;
+    unsigned long position;
+    struct vm_scope *outer;
+};
+
+struct vm_compiler {
+    struct vm_program *vm_program;
+    unsigned long height;
+    unsigned long max_height;
+    struct vm_scope *scope;
+};
+
+struct vm_frame {
+    long *return_ip;
+    long *fp;
+};
+
+size_t vm_emit(struct vm_compiler *compiler, long word) {
+    struct vm_program *vm_program = compiler->vm_program;
+
+    if (vm_program->code_length == vm_program->code_capacity) {
+        vm_program->code_capacity = vm_program->code_capacity ? vm_program->code_capacity * 2 : 256;
+        vm_program->code = realloc(vm_program->code, vm_program->code_capacity * sizeof(long));
+        if (vm_program->code == NULL) { die("realloc failure"); }
+    }
+
+    vm_program->code[vm_program->code_length] = word;
+
+    return vm_program->code_length++;
+}
+
+void vm_adjust_height(struct vm_compiler *compiler, long delta) {
+    compiler->height += delta;
+
+    if (compiler->height > compiler->max_height) {
+        compiler->max_height = compiler->height;
+    }
+}
+
+void vm_compile_expr(struct vm_compiler *compiler, struct expr *expr);
+void vm_compile_tail_expr(struct vm_compiler *compiler, struct expr *expr);
+
+void vm_compile_binop(struct vm_compiler *compiler, struct binop b) {
+    vm_compile_expr(compiler, b.l);
+    vm_compile_expr(compiler, b.r);
+
+    switch (b.type) {
+        case EQ:
+            vm_emit(compiler, OP_EQ);
+            break;
+        case PLUS:
+            vm_emit(compiler, OP_ADD);
+            break;
+        case LSHIFT:
+            vm_emit(compiler, OP_SHL);
+            break;
+        case MULT:
+            vm_emit(compiler, OP_MUL);
+            break;
+        case MINUS:
+            vm_emit(compiler, OP_SUB);
+            break;
+        case LE:
+            vm_emit(compiler, OP_LE);
+            break;
+    }
+
+    vm_adjust_height(compiler, -1);
+}
+
+void vm_compile_conditional(struct vm_compiler *compiler, struct conditional c) {
+    vm_compile_expr(compiler, c.cond);
+
+    vm_emit(compiler, OP_JUMP_IF_ZERO);
+    size_t else_patch = vm_emit(compiler, 0);
+    vm_adjust_height(compiler, -1);
+
+    vm_compile_expr(compiler, c.on_true);
+    vm_emit(compiler, OP_JUMP);
+    size_t end_patch = vm_emit(compiler, 0);
+
+    // Only one arm's value is ever on the stack.
+    vm_adjust_height(compiler, -1);
+
+    compiler->vm_program->code[else_patch] = compiler->vm_program->code_length;
+    vm_compile_expr(compiler, c.on_false);
+    compiler->vm_program->code[end_patch] = compiler->vm_program->code_length;
+}
+
+void vm_compile_call(struct vm_compiler *compiler, struct call c) {
+    struct arg_entry *arg_entry = c.args;
+
+    while (arg_entry != NULL) {
+        vm_compile_expr(compiler, arg_entry->value);
+        arg_entry = next_entry(arg_entry, struct arg_entry);
+    }
+
+    vm_emit(compiler, OP_CALL);
+    vm_emit(compiler, c.func->index);
+
+    // The arguments are replaced by the result.
+    vm_adjust_height(compiler, 1 - (long)c.func->param_count);
+}
+
+// The position in the frame of the variable in slot: that of a parameter is
+// its slot, and that of a let binding wherever its value was pushed.
+unsigned long vm_var_position(struct vm_compiler *compiler, unsigned long slot) {
+    for (struct vm_scope *scope = compiler->scope; scope != NULL; scope = scope->outer) {
+        if (scope->slot == slot) {
+            return scope->position;
+        }
+    }
+
+    return slot;
+}
+
+// Compile the value of l, which stays on the stack while its body (in tail
+// position if tail is set) runs.
+void vm_compile_let(struct vm_compiler *compiler, struct let l, bool tail) {
+    vm_compile_expr(compiler, l.value);
+
+    struct vm_scope scope = { l.slot, compiler->height - 1, compiler->scope };
+    compiler->scope = &scope;
+
+    if (tail) {
+        vm_compile_tail_expr(compiler, l.body);
+    } else {
+        vm_compile_expr(compiler, l.body);
+
+        // The body's result replaces the value.
+        vm_emit(compiler, OP_NIP);
+        vm_adjust_height(compiler, -1);
+    }
+
+    compiler->scope = scope.outer;
+}
+
+void vm_compile_expr(struct vm_compiler *compiler, struct expr *expr) {
+    switch (expr->type) {
+        case LITERAL:
+            vm_emit(compiler, OP_CONST);
+            vm_emit(compiler, expr->literal);
+            vm_adjust_height(compiler, 1);
+            break;
+        case VAR:
+            vm_emit(compiler, OP_LOAD);
+            vm_emit(compiler, vm_var_position(compiler, expr->var.slot));
+            vm_adjust_height(compiler, 1);
+            break;
+        case BINOP:
+            vm_compile_binop(compiler, expr->binop);
+            break;
+        case CONDITIONAL:
+            vm_compile_conditional(compiler, expr->conditional);
+            break;
+        case PUTS:
+            vm_compile_expr(compiler, expr->puts.body);
+            vm_emit(compiler, OP_PUTS);
+            break;
+        case CALL:
+            vm_compile_call(compiler, expr->call);
+            break;
+        case LET:
+            vm_compile_let(compiler, expr->let, false);
+            break;
+    }
+}
+
+// Compile expr, which is in tail position in a function body, along with the
+// function's return. Calls in tail position reuse the caller's frame.
+void vm_compile_tail_expr(struct vm_compiler *compiler, struct expr *expr) {
+    if (expr->type == CONDITIONAL) {
+        struct conditional c = expr->conditional;
+
+        vm_compile_expr(compiler, c.cond);
+
+        vm_emit(compiler, OP_JUMP_IF_ZERO);
+        size_t else_patch = vm_emit(compiler, 0);
+        vm_adjust_height(compiler, -1);
+
+        // Neither arm falls through, so each starts at the same height.
+        unsigned long height = compiler->height;
+        vm_compile_tail_expr(compiler, c.on_true);
+        compiler->height = height;
+
+        compiler->vm_program->code[else_patch] = compiler->vm_program->code_length;
+        vm_compile_tail_expr(compiler, c.on_false);
+    } else if (expr->type == LET) {
+        vm_compile_let(compiler, expr->let, true);
+    } else if (expr->type == CALL) {
+        struct arg_entry *arg_entry = expr->call.args;
+
+        while (arg_entry != NULL) {
+            vm_compile_expr(compiler, arg_entry->value);
+            arg_entry = next_entry(arg_entry, struct arg_entry);
+        }
+
+        vm_emit(compiler, OP_TAIL_CALL);
+        vm_emit(compiler, expr->call.func->index);
+    } else {
+        vm_compile_expr(compiler, expr);
+        vm_emit(compiler, OP_RET);
+    }
+}
+
+struct vm_program *vm_compile(struct program *p) {
+    checked_calloc(struct vm_program, vm_program);
+    struct vm_compiler compiler = { vm_program, 0, 0, NULL };
+    struct definition_entry *definition_entry = p->funcs;
+
+    vm_program->func_count = linked_list_count((struct link *)p->funcs);
+    vm_program->funcs = calloc(vm_program->func_count, sizeof(struct vm_func));
+    if (vm_program->func_count > 0 && vm_program->funcs == NULL) { die("calloc failure"); }
+
+    while (definition_entry != NULL) {
+        struct func *func = definition_entry->value;
+        struct vm_func *vm_func = &vm_program->funcs[func->index];
+
+        compiler.height = compiler.max_height = func->param_count;
+
+        vm_func->entry = vm_program->code_length;
+        vm_func->param_count = func->param_count;
+        vm_compile_tail_expr(&compiler, func->body);
+        vm_func->max_height = compiler.max_height;
+
+        definition_entry = next_entry(definition_entry, struct definition_entry);
+    }
+
+    compiler.height = compiler.max_height = 0;
+
+    vm_program->main_entry = vm_program->code_length;
+    vm_compile_expr(&compiler, p->expr);
+    vm_emit(&compiler, OP_HALT);
+    vm_program->main_max_height = compiler.max_height;
+
+    return vm_program;
+}
+
+void vm_run(struct vm_program *vm_program, unsigned long max_depth) {
+    // Indexed by enum vm_opcode.
+    static void *dispatch_table[] = {
+        &&op_const, &&op_load, &&op_nip, &&op_add, &&op_sub, &&op_mul, &&op_shl, &&op_le,
+        &&op_eq, &&op_jump, &&op_jump_if_zero, &&op_puts, &&op_call, &&op_tail_call, &&op_ret,
+        &&op_halt,
+    };
+
+    long *stack = calloc(VM_STACK_SIZE, sizeof(long));
+    struct vm_frame *frames = calloc(max_depth, sizeof(struct vm_frame));
+    if (stack == NULL || frames == NULL) { die("calloc failure"); }
+
+    long *stack_end = stack + VM_STACK_SIZE;
+    struct vm_frame *frame = frames;
+    struct vm_frame *frames_end = frames + max_depth;
+
+    long *code = vm_program->code;
+    long *ip = code + vm_program->main_entry;
+    long *sp = stack;
+    long *fp = stack;
+    struct vm_func *callee;
+    unsigned long calls = 0;
+    struct vm_frame *deepest = frames;
+
+    if (sp + vm_program->main_max_height > stack_end) {
+        die("Stack overflow: out of value stack space");
+    }
+
+#define DISPATCH() goto *dispatch_table[*ip++]
+#define BINARY_OP(expr) do { long r = *--sp; long l = sp[-1]; sp[-1] = (expr); } while (0)
+
+    DISPATCH();
+
+op_const:
+    *sp++ = *ip++;
+    DISPATCH();
+op_load:
+    *sp++ = fp[*ip++];
+    DISPATCH();
+op_nip:
+    sp--;
+    sp[-1] = *sp;
+    DISPATCH();
+op_add:
+    BINARY_OP(l + r);
+    DISPATCH();
+op_sub:
+    BINARY_OP(l - r);
+    DISPATCH();
+op_mul:
+    BINARY_OP(l * r);
+    DISPATCH();
+op_shl:
+    BINARY_OP(l << r);
+    DISPATCH();
+op_le:
+    BINARY_OP(l <= r);
+    DISPATCH();
+op_eq:
+    BINARY_OP(l == r);
+    DISPATCH();
+op_jump:
+    ip = code + *ip;
+    DISPATCH();
+op_jump_if_zero:
+    if (*--sp == 0) {
+        ip = code + *ip;
+    } else {
+        ip++;
+    }
+    DISPATCH();
+op_puts:
+    nickel_puts_i64(sp[-1]);
+    DISPATCH();
+op_call:
+    callee = &vm_program->funcs[*ip++];
+
+    if (frame == frames_end) {
+        die("Stack overflow: call depth exceeds maximum of %lu", max_depth);
+    }
+
+    if (sp - callee->param_count + callee->max_height > stack_end) {
+        die("Stack overflow: out of value stack space at call depth %ld", (long)(frame - frames));
+    }
+
+    frame->return_ip = ip;
+    frame->fp = fp;
+    frame++;
+    calls++;
+
+    if (frame > deepest) {
+        deepest = frame;
+    }
+
+    fp = sp - callee->param_count;
+    ip = code + callee->entry;
+    DISPATCH();
+op_tail_call:
+    callee = &vm_program->funcs[*ip++];
+
+    if (fp + callee->max_height > stack_end) {
+        die("Stack overflow: out of value stack space at call depth %ld", (long)(frame - frames));
+    }
+
+    // Move the arguments down over the caller's frame.
+    sp -= callee->param_count;
+    for (unsigned long i = 0; i < callee->param_count; i++) {
+        fp[i] = sp[i];
+    }
+
+    sp = fp + callee->param_count;
+    ip = code + callee->entry;
+    calls++;
+    DISPATCH();
+op_ret:
+    *fp = sp[-1];
+    sp = fp + 1;
+
+    frame--;
+    ip = frame->return_ip;
+    fp = frame->fp;
+    DISPATCH();
+op_halt:
+
+#undef BINARY_OP
+#undef DISPATCH
+
+    stats_count_calls(calls, (unsigned long)(deepest - frames));
+
+    free(frames);
+    free(stack);
+}
+
+void vm_free(struct vm_program *vm_program) {
+    free(vm_program->code);
+    free(vm_program->funcs);
+    free(vm_program);
+}
@@ -4,7 +4,9 @@
 # (files whose name matches tests/*.nkl in the top-level directory) in turn. A
 # test-program evaluation fails if the jit/interpreter output does not match
 # the expected output (which is contained in a file $f.output where $f is the
-# test program).
+# test program). By default every evaluation mode is tested, followed by the
+# command tests (see run_command_tests); pass modes as arguments to test only
+# those. A mode may be several options, e.g. "--jit --partitions=4".
 
 set -u
 
@@ -17,24 +19,40 @@ function cleanup {
 }
 trap cleanup EXIT
 
-for mode in ${*:---interpreter --jit}
-do
-    echo "Running tests with $mode "
+# Evaluate the program on stdin in the given mode. The --emit-exe mode builds
+# an executable and then runs it, and the --load-snapshot mode writes a
+# snapshot of the program and then interprets that.
+function evaluate {
+    local mode=$1
+    local options
+    read -ra options <<< "$mode"
 
-    mkdir "$OUTPUT_DIR"
+    if [[ "$mode" == --emit-exe ]]
+    then
+        ../nickel --emit-exe="$OUTPUT_DIR/a.out" && "$OUTPUT_DIR/a.out"
+        rm -f "$OUTPUT_DIR/a.out"
+    elif [[ "$mode" == --load-snapshot ]]
+    then
+        ../nickel --compile-snapshot="$OUTPUT_DIR/program.snap" &&
+            ../nickel --load-snapshot="$OUTPUT_DIR/program.snap"
+        rm -f "$OUTPUT_DIR/program.snap"
+    else
+        ../nickel "${options[@]}"
+    fi
+}
 
-    for source_file in *.nkl
-    do
-        ../nickel "$mode" < "$source_file" &>"$OUTPUT_DIR/$source_file"
-
-        if diff -u "$source_file.output" "$OUTPUT_DIR/$source_file" &>> "$OUTPUT_DIR/$source_file.output.diff"
-        then
-            printf .
-        else
-            printf F
-        fi
-    done
+# Compare the output of test $1, in $OUTPUT_DIR/$1, with that expected, in
+# $2.
+function check {
+    if diff -u "$2" "$OUTPUT_DIR/$1" &>> "$OUTPUT_DIR/$1.output.diff"
+    then
+        printf .
+    else
+        printf F
+    fi
+}
 
+function report_failures {
     echo
 
     for f in "$OUTPUT_DIR"/*.output.diff
@@ -48,6 +66,54 @@ do
         # +++ test_output/foo.nkl	2018-09-09 19:31:13.000000000 +0100
         grep -v '^\(+++\|---\)' "$f" | colordiff
     done
+}
+
+# Command tests check options that need more than a program on stdin, such as
+# --batch and --session. Each is a script, commands/$name.sh, run from this
+# directory, whose output (both stdout and stderr) must match
+# commands/$name.sh.output.
+function run_command_tests {
+    echo "Running command tests "
+
+    mkdir "$OUTPUT_DIR"
+
+    for script in commands/*.sh
+    do
+        local name
+        name=$(basename "$script")
+
+        bash "$script" &>"$OUTPUT_DIR/$name"
+        check "$name" "$script.output"
+    done
 
+    report_failures
+    cleanup
+}
+
+if [[ $# -gt 0 ]]
+then
+    modes=("$@")
+else
+    modes=(--interpreter --jit "--jit --partitions=4" --orc --vm --tiered --emit-exe --load-snapshot)
+fi
+
+for mode in "${modes[@]}"
+do
+    echo "Running tests with $mode "
+
+    mkdir "$OUTPUT_DIR"
+
+    for source_file in *.nkl
+    do
+        evaluate "$mode" < "$source_file" &>"$OUTPUT_DIR/$source_file"
+        check "$source_file" "$source_file.output"
+    done
+
+    report_failures
     cleanup
 done
+
+if [[ $# -eq 0 ]]
+then
+    run_command_tests
+fi
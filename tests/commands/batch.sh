@@ -0,0 +1,33 @@
+#!/usr/bin/env bash
+
+# --batch: each program's output is printed under its header, in order, and a
+# program that fails (whether resolving it or running it) does not stop the
+# others, but does make the exit status 1.
+
+programs='puts 1
+%%
+puts x
+%%
+def f(n)
+  f(n + 1) + 1
+end
+
+puts f(0)
+%%
+puts 4'
+
+# Only the interpreter and VM bound the depth of calls.
+for mode in --interpreter --vm
+do
+    echo "$programs" | ../nickel --batch "$mode" --jobs=2 --max-depth=100
+    echo "status $?"
+done
+
+for mode in --jit --orc --tiered
+do
+    ../nickel --batch "$mode" --jobs=2 simple_func.nkl fail_nested_var_lookup.nkl trivial_func.nkl
+    echo "status $?"
+done
+
+../nickel --batch --stats < /dev/null
+echo "status $?"
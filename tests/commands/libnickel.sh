@@ -0,0 +1,8 @@
+#!/usr/bin/env bash
+
+# libnickel.h, through tests/libnickel_test.c (which make test builds): calls
+# from two threads, output written out as each thread exits, and compile and
+# call errors handed back rather than exiting.
+
+../libnickel_test
+echo "status $?"
@@ -0,0 +1,27 @@
+#!/usr/bin/env bash
+
+# --map: calls a function once per line (or, with --map-format=binary, once
+# per tuple of native integers) of stdin, and rejects bad names and input.
+
+printf '1 2\n3, 4\n\n0 0\n  10\t-2\n' | ../nickel --map=poly commands/poly.nkl
+echo "status $?"
+
+# Two tuples of little-endian 64-bit integers: (1, 2) and (3, 4).
+printf '\1\0\0\0\0\0\0\0\2\0\0\0\0\0\0\0\3\0\0\0\0\0\0\0\4\0\0\0\0\0\0\0' |
+    ../nickel --map=poly --map-format=binary commands/poly.nkl | od -An -td8 -w8
+echo "status $?"
+
+for input in '1' '1 2 3' '1 x' '99999999999999999999 1'
+do
+    echo "$input" | ../nickel --map=poly commands/poly.nkl
+    echo "status $?"
+done
+
+printf '\1\0\0\0\0\0\0\0\2\0\0\0' | ../nickel --map=poly --map-format=binary commands/poly.nkl
+echo "status $?"
+
+../nickel --map=nope commands/poly.nkl < /dev/null
+echo "status $?"
+
+../nickel --map=poly --map-format=xml commands/poly.nkl < /dev/null
+echo "status $?"
@@ -0,0 +1,25 @@
+#!/usr/bin/env bash
+
+# --memoize: every mode makes the same memo lookups, even of a function that is
+# only called through another that does not touch memory itself, and so might
+# otherwise have its calls merged. --profile counts those calls the same way.
+
+program='
+def fib(n)
+  if n <= 1 then n else fib(n - 1) + fib(n - 2) end
+end
+
+def k(n)
+  fib(n)
+end
+
+puts k(25) + k(25) + k(25)
+'
+
+for mode in --interpreter --jit "--jit --partitions=4" --orc --tiered
+do
+    read -ra options <<< "$mode"
+    echo "$mode"
+    echo "$program" | ../nickel "${options[@]}" --no-ast-opt --memoize --memo-stats 2>&1
+    echo "$program" | ../nickel "${options[@]}" --no-ast-opt --profile 2>&1 | awk '$1 == "k" { print $1, $2 }'
+done
@@ -0,0 +1,36 @@
+#!/usr/bin/env bash
+
+# --profile and --perf-map. The profile's times vary, so only its calls are
+# checked.
+
+program='
+def sq(x)
+  x * x
+end
+
+def sum_squares(n)
+  if n == 0 then 0 else sq(n) + sum_squares(n - 1) end
+end
+
+puts sum_squares(10)
+'
+
+for mode in --interpreter --jit --orc --tiered
+do
+    echo "$program" | ../nickel "$mode" --profile --no-ast-opt 2>&1 | awk 'NF > 1 { print $1, $2; next } { print }'
+done
+
+echo "$program" | ../nickel --vm --profile
+echo "status $?"
+
+# Each function compiled is named in /tmp/perf-<pid>.map (unoptimised, so
+# that none are inlined away).
+for mode in --jit --orc
+do
+    echo "$program" | ../nickel "$mode" --perf-map --no-ast-opt -O0 &
+    pid=$!
+    wait "$pid"
+
+    awk '{ print $3 }' "/tmp/perf-$pid.map" | sort
+    rm -f "/tmp/perf-$pid.map"
+done
@@ -0,0 +1,41 @@
+#!/usr/bin/env bash
+
+# --session: each submission is compiled as it arrives, redefining a function
+# replaces it for the callers compiled before it, and a submission that fails
+# is reported and skipped, but makes the exit status 1.
+
+../nickel --session <<'SUBMISSIONS'
+def sq(x)
+  x * x
+end
+
+def sum_sq(a, b)
+  sq(a) + sq(b)
+end
+puts sum_sq(3, 4)
+
+def sq(x)
+  x + x
+end
+puts sum_sq(3, 4)
+
+def sq(x, y)
+  x * y
+end
+
+puts y
+
+puts (
+
+puts sq(5)
+SUBMISSIONS
+echo "status $?"
+
+../nickel --session <<'SUBMISSIONS'
+def f(n)
+  n + 1
+end
+
+puts f(f(1))
+SUBMISSIONS
+echo "status $?"
@@ -0,0 +1,60 @@
+#!/usr/bin/env bash
+
+# --load-snapshot refuses an image whose references are all to records of the
+# right kind, but whose program nickel could not have resolved.
+
+snap=$(mktemp)
+trap 'rm -f "$snap" "$snap.bad"' EXIT
+
+# The little-endian 64-bit value at byte offset $2 of file $1.
+function u64 {
+    od -An -tu8 -j "$2" -N8 "$1" | tr -d ' '
+}
+
+# Write the value $3 over the 64 bits at byte offset $2 of a copy of $1.
+function corrupt {
+    cp "$1" "$snap.bad"
+    printf "$(printf '\\%03o' $(($3 & 255)) $(($3 >> 8 & 255)) $(($3 >> 16 & 255)) $(($3 >> 24 & 255)) 0 0 0 0)" |
+        dd of="$snap.bad" bs=1 seek="$2" conv=notrunc status=none
+}
+
+printf 'def f(x)\n  x\nend\n\nputs f(1)\n' | ../nickel --no-ast-opt --compile-snapshot="$snap"
+../nickel --load-snapshot="$snap"
+echo "status $?"
+
+# The header is the magic, version and byte order (16 bytes), then the record
+# sizes, offsets and counts of its eight sections. The expressions are f's
+# body (x), then the top-level puts, its call and the call's argument; each
+# starts with its type, padded to 8 bytes.
+expr_size=$(u64 "$snap" $((16 + 4 * 8)))
+exprs=$(u64 "$snap" $((16 + 64 + 4 * 8)))
+args=$(u64 "$snap" $((16 + 64 + 5 * 8)))
+
+# x's slot, past the end of f's frame.
+corrupt "$snap" $((exprs + 16)) 1
+../nickel --load-snapshot="$snap.bad"
+echo "status $?"
+
+# The call's arguments, dropped.
+corrupt "$snap" $((exprs + 2 * expr_size + 16)) 0
+../nickel --load-snapshot="$snap.bad"
+echo "status $?"
+
+# The call's argument, made the call itself.
+corrupt "$snap" $((args + 8)) $((exprs + 2 * expr_size))
+../nickel --load-snapshot="$snap.bad"
+echo "status $?"
+
+# f's body, made the puts, which comes after it but is also the top level.
+corrupt "$snap" "$(($(u64 "$snap" $((16 + 64 + 2 * 8))) + 16))" $((exprs + expr_size))
+../nickel --load-snapshot="$snap.bad"
+echo "status $?"
+
+# Whether each function is pure is found again rather than read from the
+# image, so one wrongly marked pure there still prints each time it is called.
+# Its flag is the first byte after its six 8-byte fields.
+printf 'def g(x)\n  h(puts x) + 1\nend\n\ndef h(x)\n  x\nend\n\nputs g(7) + g(7)\n' |
+    ../nickel --no-ast-opt --compile-snapshot="$snap"
+corrupt "$snap" "$(($(u64 "$snap" $((16 + 64 + 2 * 8))) + 48))" 1
+../nickel --jit --load-snapshot="$snap.bad"
+echo "status $?"
@@ -0,0 +1,32 @@
+#!/usr/bin/env bash
+
+# --stats: its counters are deterministic, but its times are not, so only the
+# phases' names are checked, and only whether any IR or code was generated.
+
+function hide_times {
+    awk '$1 ~ /^(ir_instructions|machine_code_bytes)/ { print $1, ($2 > 0 ? "some" : "none"); next }
+         NF == 3 && $2 ~ /^[0-9.]+$/ { print $1; next }
+         { print }'
+}
+
+program='
+def fib(n)
+  if n <= 1 then n else fib(n - 1) + fib(n - 2) end
+end
+
+puts fib(15)
+'
+
+# The interpreter and VM count the same calls.
+echo "$program" | ../nickel --interpreter --stats --no-ast-opt 2>&1 | hide_times
+echo "$program" | ../nickel --vm --stats --no-ast-opt 2>&1 | tail -2
+
+# The AST optimiser folds the whole program away.
+echo 'puts 1 + 2 * 3' | ../nickel --jit --stats 2>&1 | hide_times | tail -10
+
+# The JSON holds the same fields, on one line.
+echo "$program" | ../nickel --jit --stats=json 2>&1 | grep -o '"[a-z_]*":' | tr -d '\n'
+echo
+
+echo "$program" | ../nickel --stats=xml
+echo "status $?"
@@ -0,0 +1,189 @@
+// Exercises libnickel.h: compiles a program with each engine, looks up and
+// calls its functions from two threads at once, and checks that failures are
+// handed back as errors. Run by commands/libnickel.sh.
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libnickel.h"
+
+#define CALLS 1000
+
+static const char *program =
+    "def fib(n)\n"
+    "  if n <= 1 then n else fib(n - 1) + fib(n - 2) end\n"
+    "end\n"
+    "def depth(n)\n"
+    "  if n == 0 then 0 else 1 + depth(n - 1) end\n"
+    "end\n"
+    "def shout(x)\n"
+    "  puts x\n"
+    "end\n";
+
+struct caller {
+    const struct nickel_function *function;
+    int64_t n;
+    int64_t result;
+    bool ok;
+};
+
+// Call the function CALLS times, checking that every call agrees.
+static void *call_repeatedly(void *arg) {
+    struct caller *caller = arg;
+    int64_t result;
+
+    caller->ok = nickel_call(caller->function, &caller->n, &caller->result, NULL);
+
+    for (int i = 0; i < CALLS && caller->ok; i++) {
+        caller->ok = nickel_call(caller->function, &caller->n, &result, NULL) && result == caller->result;
+    }
+
+    return NULL;
+}
+
+// Call the function once, leaving what it prints for the thread's exit to
+// write out.
+static void *call_once(void *arg) {
+    struct caller *caller = arg;
+
+    caller->ok = nickel_call(caller->function, &caller->n, &caller->result, NULL);
+
+    return NULL;
+}
+
+struct deep_caller {
+    const struct nickel_function *depth;
+    size_t stack_size;
+    char *error;
+};
+
+// Recurse too deeply, then check that the environment that failed is reused.
+static void *call_depth(void *arg) {
+    struct deep_caller *caller = arg;
+    int64_t n = 1000000, result;
+
+    if (nickel_call(caller->depth, &n, &result, &caller->error)) {
+        caller->error = strdup("no error");
+    } else if (strncmp(caller->error, "Stack overflow: native", strlen("Stack overflow: native")) == 0) {
+        // Where the native stack runs out depends on the build.
+        caller->error[strlen("Stack overflow: native")] = '\0'; /* Flawfinder: ignore */
+    }
+
+    n = 10;
+
+    if (!nickel_call(caller->depth, &n, &result, NULL) || result != 10) {
+        free(caller->error);
+        caller->error = strdup("reusing the environment failed");
+    }
+
+    return NULL;
+}
+
+static void start_with_stack(pthread_t *thread, void *(*run)(void *), void *arg, size_t stack_size) {
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, stack_size);
+
+    if (pthread_create(thread, &attr, run, arg) != 0) {
+        printf("pthread_create failure\n");
+        exit(1);
+    }
+
+    pthread_attr_destroy(&attr);
+}
+
+static void run_with_stack(void *(*run)(void *), void *arg, size_t stack_size) {
+    pthread_t thread;
+
+    start_with_stack(&thread, run, arg, stack_size);
+    pthread_join(thread, NULL);
+}
+
+static void report_error(const char *what, char *error) {
+    printf("%s: %s\n", what, error != NULL ? error : "(no error)");
+    free(error);
+}
+
+static void test_engine(enum nickel_engine engine, const char *name) {
+    char *error = NULL;
+    struct nickel *nickel = nickel_compile(program, strlen(program), engine, &error); /* Flawfinder: ignore */
+
+    if (nickel == NULL) {
+        report_error(name, error);
+        return;
+    }
+
+    const struct nickel_function *fib = nickel_lookup(nickel, "fib");
+    const struct nickel_function *depth = nickel_lookup(nickel, "depth");
+    struct caller callers[2] = { { .function = fib, .n = 20 }, { .function = fib, .n = 21 } };
+    struct caller shouter = { .function = nickel_lookup(nickel, "shout"), .n = 42 };
+    pthread_t threads[2];
+
+    printf("%s: fib takes %lu, nope is %s, native is %s\n", name, nickel_param_count(fib),
+           nickel_lookup(nickel, "nope") == NULL ? "missing" : "found",
+           nickel_native(fib) != NULL ? "set" : "NULL");
+    fflush(stdout);
+
+    for (int i = 0; i < 2; i++) {
+        start_with_stack(&threads[i], call_repeatedly, &callers[i], 1024 * 1024);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        pthread_join(threads[i], NULL);
+        printf("%s: fib(%" PRId64 ") %s: %" PRId64 "\n", name, callers[i].n, callers[i].ok ? "ok" : "failed",
+               callers[i].result);
+    }
+
+    fflush(stdout);
+    run_with_stack(call_once, &shouter, 1024 * 1024);
+    printf("%s: shout %s\n", name, shouter.ok ? "ok" : "failed");
+    fflush(stdout);
+
+    // The interpreter guards the stack of whichever thread calls it: a large
+    // one reaches the limit on the depth of calls, and a small one runs out.
+    if (engine == NICKEL_INTERPRETER) {
+        struct deep_caller deep_callers[2] = {
+            { .depth = depth, .stack_size = 1024 * 1024 * 1024 },
+            { .depth = depth, .stack_size = 1024 * 1024 },
+        };
+
+        for (int i = 0; i < 2; i++) {
+            run_with_stack(call_depth, &deep_callers[i], deep_callers[i].stack_size);
+            printf("%s: %zu byte stack: %s\n", name, deep_callers[i].stack_size, deep_callers[i].error);
+            free(deep_callers[i].error);
+        }
+
+        fflush(stdout);
+    }
+
+    nickel_release(nickel);
+}
+
+int main(void) {
+    const char *bad_programs[] = {
+        "def f(x) x +", "def f(x) y end", "def f(x) g(x) end", "def f(x) x + 99999999999999999999 end",
+    };
+    char *error = NULL;
+
+    test_engine(NICKEL_JIT, "jit");
+    test_engine(NICKEL_INTERPRETER, "interpreter");
+
+    for (size_t i = 0; i < sizeof(bad_programs) / sizeof(bad_programs[0]); i++) {
+        struct nickel *nickel = nickel_compile(bad_programs[i], strlen(bad_programs[i]), /* Flawfinder: ignore */
+                                               NICKEL_JIT, &error);
+
+        if (nickel != NULL) {
+            printf("compiled: %s\n", bad_programs[i]);
+            nickel_release(nickel);
+        } else {
+            report_error(bad_programs[i], error);
+            error = NULL;
+        }
+    }
+
+    return 0;
+}